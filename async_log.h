@@ -0,0 +1,251 @@
+#ifndef ASYNC_LOG_H
+#define ASYNC_LOG_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "ipc_common.h"
+#include "futex_wait.h"
+
+//--- Асинхронный журнал: горячие потоки не делают printf(), а дописывают готовые
+//--- строки (или любые байты) в свой буфер - кольцо "один писатель - один читатель"
+//--- без замков и системных вызовов. Фоновый поток собирает содержимое всех буферов
+//--- в один writev() и пишет пачкой.
+//---
+//--- Порядок сохраняется внутри потока; строки разных потоков перемешиваются
+//--- пачками, а не по времени. Пока журнал не запущен (async_log_start),
+//--- async_log_printf() - обычный printf(), поэтому его можно подставить вместо
+//--- printf() и включать журнал ключом командной строки.
+
+#define ASYNC_LOG_BUFSIZE  (64 * 1024) // на поток, степень двойки
+#define ASYNC_LOG_LINE_MAX 1024
+#define ASYNC_LOG_IOV      64          // буферов в одном writev() - по 2 iovec на буфер
+#define ASYNC_LOG_FLUSH_MS 10          // как часто фоновый поток просыпается сам
+
+//--- head пишет только поток-владелец, tail - только фоновый поток
+struct async_log_buf {
+    uint64_t              head CACHE_ALIGNED;
+    uint64_t              cached_tail;
+    uint64_t              stalls; // сколько раз писатель ждал место в буфере
+    uint64_t              tail CACHE_ALIGNED;
+    uint32_t              in_use;  // 0 - поток-владелец завершился, буфер можно отдать другому
+    struct async_log_buf *next;
+    char                  data[ASYNC_LOG_BUFSIZE];
+};
+
+struct async_log {
+    int                   fd;
+    int                   running;
+    pthread_t             thread;
+    pthread_key_t         key;
+    struct async_log_buf *bufs;   // список всех буферов, только растет
+    struct shm_event      wakeup; // на нем спит фоновый поток
+    uint64_t              bytes;
+    uint64_t              writes;
+};
+
+static struct async_log                 async_log_state; // fd задает async_log_start()
+static __thread struct async_log_buf   *async_log_tls;
+
+//--- Деструктор ключа потока: буфер дочитает фоновый поток, потом его займет новый поток
+static void async_log_release(void *p) {
+    __atomic_store_n(&((struct async_log_buf *)p)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+//--- Буфер потока: сначала ищем освобожденный и уже вычитанный, иначе создаем новый
+static inline struct async_log_buf *async_log_buf_get(void) {
+    struct async_log_buf *b;
+    uint32_t free_;
+
+    if ( async_log_tls )
+        return async_log_tls;
+    for ( b = __atomic_load_n(&async_log_state.bufs, __ATOMIC_ACQUIRE); b; b = b->next ) {
+        free_ = 0;
+        if ( !__atomic_load_n(&b->in_use, __ATOMIC_ACQUIRE) &&
+             __atomic_load_n(&b->tail, __ATOMIC_ACQUIRE) == __atomic_load_n(&b->head, __ATOMIC_ACQUIRE) &&
+             __atomic_compare_exchange_n(&b->in_use, &free_, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED) )
+            break;
+    }
+    if ( !b ) {
+        if ( posix_memalign((void **)&b, CACHE_LINE_SIZE, sizeof(*b)) )
+            return NULL;
+        memset(b, 0, sizeof(*b) - ASYNC_LOG_BUFSIZE);
+        b->in_use = 1;
+        b->next = __atomic_load_n(&async_log_state.bufs, __ATOMIC_RELAXED);
+        while ( !__atomic_compare_exchange_n(&async_log_state.bufs, &b->next, b, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED) )
+            ;
+    }
+    pthread_setspecific(async_log_state.key, b);
+    return async_log_tls = b;
+}
+
+//--- Добавляет len байт в буфер потока. Если места нет - будит фоновый поток и ждет.
+static inline void async_log_write(const void *data, size_t len) {
+    struct async_log_buf *b;
+    size_t off, first;
+
+    if ( !__atomic_load_n(&async_log_state.running, __ATOMIC_ACQUIRE) || (b = async_log_buf_get()) == NULL ) {
+        fwrite(data, 1, len, stdout);
+        return;
+    }
+    if ( len > ASYNC_LOG_BUFSIZE )
+        len = ASYNC_LOG_BUFSIZE;
+    while ( ASYNC_LOG_BUFSIZE - (b->head - b->cached_tail) < len ) {
+        b->cached_tail = __atomic_load_n(&b->tail, __ATOMIC_ACQUIRE);
+        if ( ASYNC_LOG_BUFSIZE - (b->head - b->cached_tail) >= len )
+            break;
+        if ( !__atomic_load_n(&async_log_state.running, __ATOMIC_ACQUIRE) )
+            return; // журнал остановлен - вычитывать буфер больше некому
+        b->stalls++;
+        shm_event_notify(&async_log_state.wakeup);
+        sched_yield();
+    }
+
+    off = b->head & (ASYNC_LOG_BUFSIZE - 1);
+    first = len < ASYNC_LOG_BUFSIZE - off ? len : ASYNC_LOG_BUFSIZE - off;
+    memcpy(b->data + off, data, first);
+    memcpy(b->data, (const char *)data + first, len - first);
+    __atomic_store_n(&b->head, b->head + len, __ATOMIC_RELEASE);
+
+    //--- будим фоновый поток, только когда буфер заполнился наполовину:
+    //--- в остальное время он проснется сам по таймеру
+    if ( b->head - b->cached_tail > ASYNC_LOG_BUFSIZE / 2 ) {
+        b->cached_tail = __atomic_load_n(&b->tail, __ATOMIC_ACQUIRE);
+        if ( b->head - b->cached_tail > ASYNC_LOG_BUFSIZE / 2 )
+            shm_event_notify(&async_log_state.wakeup);
+    }
+}
+
+static inline void async_log_vprintf(const char *fmt, va_list ap) {
+    char line[ASYNC_LOG_LINE_MAX];
+    int len;
+
+    if ( !__atomic_load_n(&async_log_state.running, __ATOMIC_ACQUIRE) ) {
+        vprintf(fmt, ap);
+        return;
+    }
+    if ( (len = vsnprintf(line, sizeof(line), fmt, ap)) < 0 )
+        return;
+    async_log_write(line, (size_t)len < sizeof(line) ? (size_t)len : sizeof(line) - 1);
+}
+
+static inline void async_log_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+static inline void async_log_printf(const char *fmt, ...) {
+    va_list ap;
+
+    va_start(ap, fmt);
+    async_log_vprintf(fmt, ap);
+    va_end(ap);
+}
+
+//--- Один проход фонового потока: все накопленное - одним writev().
+//--- Возвращает число записанных байт, 0 - писать нечего.
+static inline ssize_t async_log_drain(struct async_log *log) {
+    struct iovec iov[2 * ASYNC_LOG_IOV];
+    struct async_log_buf *bufs[ASYNC_LOG_IOV], *b;
+    uint64_t sizes[ASYNC_LOG_IOV], head, tail, n, first;
+    ssize_t written, left;
+    int nbufs = 0, niov = 0, i;
+
+    for ( b = __atomic_load_n(&log->bufs, __ATOMIC_ACQUIRE); b && nbufs < ASYNC_LOG_IOV; b = b->next ) {
+        tail = b->tail;
+        head = __atomic_load_n(&b->head, __ATOMIC_ACQUIRE);
+        if ( head == tail )
+            continue;
+        n = head - tail;
+        first = tail & (ASYNC_LOG_BUFSIZE - 1);
+        iov[niov].iov_base = b->data + first;
+        iov[niov++].iov_len = n < ASYNC_LOG_BUFSIZE - first ? n : ASYNC_LOG_BUFSIZE - first;
+        if ( n > iov[niov - 1].iov_len ) {
+            iov[niov].iov_base = b->data;
+            iov[niov].iov_len = n - iov[niov - 1].iov_len;
+            niov++;
+        }
+        bufs[nbufs] = b;
+        sizes[nbufs++] = n;
+    }
+    if ( !niov )
+        return 0;
+
+    while ( (written = writev(log->fd, iov, niov)) == -1 && errno == EINTR )
+        ;
+    if ( written <= 0 ) {
+        //--- писать некуда - выбрасываем, иначе писатели встанут навсегда
+        written = 0;
+        for ( i = 0; i < nbufs; i++ )
+            written += sizes[i];
+    }
+    log->bytes += written;
+    log->writes++;
+    //--- при частичной записи буферы продвигаются по порядку, остальное уйдет в следующий раз
+    for ( left = written, i = 0; i < nbufs && left > 0; i++ ) {
+        n = (uint64_t)left < sizes[i] ? (uint64_t)left : sizes[i];
+        __atomic_store_n(&bufs[i]->tail, bufs[i]->tail + n, __ATOMIC_RELEASE);
+        left -= n;
+    }
+    return written;
+}
+
+static void *async_log_thread(void *p) {
+    struct async_log *log = (struct async_log *)p;
+    struct timespec ts = { 0, ASYNC_LOG_FLUSH_MS * 1000000L };
+    uint32_t seq;
+
+    for ( ;; ) {
+        if ( async_log_drain(log) > 0 )
+            continue;
+        if ( !__atomic_load_n(&log->running, __ATOMIC_ACQUIRE) )
+            break;
+        seq = shm_event_prepare_wait(&log->wakeup);
+        if ( async_log_drain(log) > 0 ) {
+            shm_event_cancel_wait(&log->wakeup);
+            continue;
+        }
+        futex(&log->wakeup.seq, FUTEX_WAIT, seq, &ts);
+        shm_event_cancel_wait(&log->wakeup);
+    }
+    //--- после остановки могли дописать еще
+    while ( async_log_drain(log) > 0 )
+        ;
+    return NULL;
+}
+
+//--- Запускает фоновый поток, который пишет журнал в fd.
+//--- То, что уже лежит в буфере stdio, выводится сразу, чтобы не перепутать порядок.
+static inline int async_log_start(int fd) {
+    struct async_log *log = &async_log_state;
+
+    fflush(stdout);
+    log->fd = fd;
+    shm_event_init(&log->wakeup);
+    if ( pthread_key_create(&log->key, async_log_release) ) {
+        perror("pthread_key_create");
+        return -1;
+    }
+    __atomic_store_n(&log->running, 1, __ATOMIC_RELEASE);
+    if ( pthread_create(&log->thread, NULL, async_log_thread, log) ) {
+        perror("pthread_create");
+        log->running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+//--- Останавливает фоновый поток, дописав все, что успели положить в буферы.
+//--- Буферы не освобождаются: потоки, которые еще пишут, перейдут на printf().
+static inline void async_log_stop(void) {
+    struct async_log *log = &async_log_state;
+
+    if ( !__atomic_exchange_n(&log->running, 0, __ATOMIC_ACQ_REL) )
+        return;
+    shm_event_notify(&log->wakeup);
+    pthread_join(log->thread, NULL);
+}
+
+#endif
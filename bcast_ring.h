@@ -0,0 +1,285 @@
+#ifndef BCAST_RING_H
+#define BCAST_RING_H
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include "ipc_common.h"
+#include "futex_wait.h"
+
+//--- Широковещательное кольцо "один писатель - много читателей" в разделяемой памяти
+//--- (в духе LMAX Disruptor). Писатель нумерует записи и кладет запись seq в ячейку
+//--- seq & mask. Каждый читатель ведет свой курсор и читает каждую запись сам,
+//--- ничего не забирая из кольца: одна копия данных на всех читателей.
+//---
+//--- Без гейтинга писатель никого не ждет и перезаписывает старые ячейки. Отставший
+//--- читатель узнает об этом по номеру в ячейке: он уже не равен его курсору.
+//--- Тогда читатель перепрыгивает на самую старую живую запись и узнает, сколько потерял.
+//--- С гейтингом (BCAST_GATED) писатель не обгоняет самого медленного
+//--- зарегистрированного читателя больше чем на круг.
+
+#define BCAST_RING_MAGIC 0x42434153 // "BCAS"
+#define BCAST_SLOT_SIZE  (2 * CACHE_LINE_SIZE)
+#define BCAST_MSG_MAX    (BCAST_SLOT_SIZE - sizeof(uint64_t) - sizeof(uint32_t))
+#define BCAST_READERS    64
+#define BCAST_GATED      0x01
+#define BCAST_WRITING    UINT64_MAX // в ячейку идет запись
+#define BCAST_GATE_MS    100        // как часто гейтинг проверяет, живы ли читатели
+
+//--- seq - номер записи в ячейке; пока писатель ее меняет - BCAST_WRITING
+struct bcast_slot {
+    uint64_t seq;
+    uint32_t len;
+    char     data[BCAST_MSG_MAX];
+} CACHE_ALIGNED;
+
+//--- Место читателя в таблице. cursor - номер следующей записи, которую он прочитает.
+//--- Пишет его только сам читатель, писатель читает только при гейтинге.
+struct bcast_reader {
+    uint32_t active;
+    int32_t  pid;
+    uint64_t cursor;
+    uint64_t lost;
+} CACHE_ALIGNED;
+
+struct bcast_ring_hdr {
+    uint32_t            magic;
+    uint32_t            capacity; // степень двойки
+    uint32_t            flags;
+    uint64_t            head CACHE_ALIGNED; // номер следующей записи, пишет только писатель
+    struct shm_event    published CACHE_ALIGNED; // на нем спят читатели
+    struct shm_event    progress  CACHE_ALIGNED; // на нем спит писатель при гейтинге
+    struct bcast_reader readers[BCAST_READERS];
+} CACHE_ALIGNED;
+
+//--- Локальное состояние писателя или читателя
+struct bcast_ring {
+    struct bcast_ring_hdr *hdr;
+    struct bcast_slot     *slots;
+    uint64_t               mask;
+    uint64_t               head;     // писатель: своя копия head
+    uint64_t               min_gate; // писатель: последний увиденный минимум курсоров
+    struct bcast_reader   *reader;   // читатель: свое место в таблице
+    uint64_t               cursor;   // читатель: своя копия курсора
+};
+
+static inline size_t bcast_ring_size(uint32_t capacity) {
+    return sizeof(struct bcast_ring_hdr) + (size_t)capacity * sizeof(struct bcast_slot);
+}
+
+//--- Разметка свежей памяти. Вызывается один раз создателем сегмента.
+static inline int bcast_ring_init(void *mem, uint32_t capacity, uint32_t flags) {
+    struct bcast_ring_hdr *hdr = (struct bcast_ring_hdr *)mem;
+    struct bcast_slot *slots = (struct bcast_slot *)(hdr + 1);
+    uint32_t i;
+
+    if ( !capacity || (capacity & (capacity - 1)) )
+        return -1;
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->capacity = capacity;
+    hdr->flags = flags;
+    shm_event_init(&hdr->published);
+    shm_event_init(&hdr->progress);
+    //--- ни одна ячейка еще не содержит записи с номером, который ждет читатель
+    for ( i = 0; i < capacity; i++ )
+        slots[i].seq = BCAST_WRITING;
+    __atomic_store_n(&hdr->magic, BCAST_RING_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static inline int bcast_ring_attach(struct bcast_ring *r, void *mem) {
+    r->hdr = (struct bcast_ring_hdr *)mem;
+    if ( __atomic_load_n(&r->hdr->magic, __ATOMIC_ACQUIRE) != BCAST_RING_MAGIC )
+        return -1;
+    r->slots = (struct bcast_slot *)(r->hdr + 1);
+    r->mask = r->hdr->capacity - 1;
+    r->head = __atomic_load_n(&r->hdr->head, __ATOMIC_ACQUIRE);
+    r->min_gate = r->head;
+    r->reader = NULL;
+    r->cursor = r->head;
+    return 0;
+}
+
+//--- Читатель занимает место в таблице и начинает с текущей позиции писателя.
+//--- Возвращает номер места или -1, если мест нет.
+static inline int bcast_reader_join(struct bcast_ring *r) {
+    struct bcast_reader *rd;
+    uint32_t free_;
+    int i;
+
+    for ( i = 0; i < BCAST_READERS; i++ ) {
+        rd = &r->hdr->readers[i];
+        free_ = 0;
+        if ( !__atomic_compare_exchange_n(&rd->active, &free_, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED) )
+            continue;
+        rd->pid = getpid();
+        rd->lost = 0;
+        r->cursor = __atomic_load_n(&r->hdr->head, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&rd->cursor, r->cursor, __ATOMIC_RELEASE);
+        //--- курсор опубликован раньше, чем писатель увидит нас в таблице
+        __atomic_store_n(&rd->active, 2, __ATOMIC_SEQ_CST);
+        //--- пока active был 1, гейтинг писателя нас не учитывал и мог уйти дальше
+        //--- прочитанного head больше чем на круг. Перечитываем head после публикации:
+        //--- проход, который нас не увидел, был раньше (см. барьер в bcast_ring_min_cursor),
+        //--- поэтому писатель не перезапишет запись head, пока не увидит наш курсор.
+        r->cursor = __atomic_load_n(&r->hdr->head, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&rd->cursor, r->cursor, __ATOMIC_RELEASE);
+        r->reader = rd;
+        return i;
+    }
+    return -1;
+}
+
+static inline void bcast_reader_leave(struct bcast_ring *r) {
+    if ( !r->reader )
+        return;
+    __atomic_store_n(&r->reader->active, 0, __ATOMIC_RELEASE);
+    shm_event_notify(&r->hdr->progress); // писатель мог ждать именно нас
+    r->reader = NULL;
+}
+
+//--- Минимальный курсор среди зарегистрированных читателей (head, если их нет).
+//--- Места умерших процессов освобождаются, иначе они остановили бы писателя навсегда.
+static inline uint64_t bcast_ring_min_cursor(struct bcast_ring *r, int reap) {
+    struct bcast_reader *rd;
+    uint64_t min = r->head, c;
+    int i;
+
+    //--- пара к SEQ_CST в bcast_reader_join: либо мы увидим нового читателя,
+    //--- либо он увидит наш head и начнет не раньше него
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for ( i = 0; i < BCAST_READERS; i++ ) {
+        rd = &r->hdr->readers[i];
+        if ( __atomic_load_n(&rd->active, __ATOMIC_ACQUIRE) != 2 )
+            continue;
+        if ( reap && kill(rd->pid, 0) == -1 && errno == ESRCH ) {
+            __atomic_store_n(&rd->active, 0, __ATOMIC_RELEASE);
+            continue;
+        }
+        c = __atomic_load_n(&rd->cursor, __ATOMIC_ACQUIRE);
+        if ( c < min )
+            min = c;
+    }
+    return min;
+}
+
+//--- Гейтинг: ждем, пока самый медленный читатель не освободит ячейку под запись head
+static inline void bcast_ring_gate(struct bcast_ring *r) {
+    struct timespec ts = { 0, BCAST_GATE_MS * 1000000L };
+    int spin = SHM_EVENT_SPIN, reap = 0;
+    uint32_t seq;
+
+    for ( ;; ) {
+        r->min_gate = bcast_ring_min_cursor(r, reap);
+        if ( r->head - r->min_gate <= r->mask )
+            return;
+        if ( spin-- > 0 ) {
+            cpu_relax();
+            continue;
+        }
+        seq = shm_event_prepare_wait(&r->hdr->progress);
+        r->min_gate = bcast_ring_min_cursor(r, 0);
+        if ( r->head - r->min_gate <= r->mask ) {
+            shm_event_cancel_wait(&r->hdr->progress);
+            return;
+        }
+        //--- спим с тайм-аутом: умерший читатель никогда не разбудит писателя
+        futex(&r->hdr->progress.seq, FUTEX_WAIT, seq, &ts);
+        shm_event_cancel_wait(&r->hdr->progress);
+        reap = 1;
+    }
+}
+
+//--- Писатель: публикует запись и возвращает ее номер. Запись длиннее BCAST_MSG_MAX
+//--- не помещается в ячейку: тогда возвращается BCAST_WRITING (errno = EMSGSIZE).
+static inline uint64_t bcast_ring_publish(struct bcast_ring *r, const void *data, uint32_t len) {
+    struct bcast_slot *slot = &r->slots[r->head & r->mask];
+    uint64_t seq = r->head;
+
+    if ( len > BCAST_MSG_MAX ) {
+        errno = EMSGSIZE;
+        return BCAST_WRITING;
+    }
+    //--- минимум курсоров перечитываем, только когда старого запаса уже не хватает
+    if ( (r->hdr->flags & BCAST_GATED) && r->head - r->min_gate > r->mask )
+        bcast_ring_gate(r);
+
+    //--- как в seqlock: сначала ячейка помечается "в работе", потом меняются данные
+    __atomic_store_n(&slot->seq, BCAST_WRITING, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->len = len;
+    memcpy(slot->data, data, len);
+    __atomic_store_n(&slot->seq, seq, __ATOMIC_RELEASE);
+    __atomic_store_n(&r->hdr->head, ++r->head, __ATOMIC_RELEASE);
+    shm_event_notify(&r->hdr->published);
+    return seq;
+}
+
+//--- Читатель: копирует следующую запись в buf (не больше size байт).
+//--- Возвращает длину записи или -1, если новых записей нет.
+//--- В *lost - сколько записей писатель успел перезаписать до того, как мы их прочитали.
+static inline int bcast_ring_read(struct bcast_ring *r, void *buf, uint32_t size, uint64_t *lost) {
+    struct bcast_slot *slot;
+    uint64_t head, seq, oldest;
+    uint32_t len;
+
+    *lost = 0;
+    for ( ;; ) {
+        head = __atomic_load_n(&r->hdr->head, __ATOMIC_ACQUIRE);
+        if ( r->cursor >= head )
+            return -1;
+        //--- отстали больше чем на круг - ячейки с нашей записью уже нет.
+        //--- Запись head - capacity еще может быть цела: ее ячейку писатель займет следующей.
+        oldest = head > r->mask ? head - r->mask - 1 : 0;
+        if ( r->cursor < oldest ) {
+            *lost += oldest - r->cursor;
+            r->cursor = oldest;
+        }
+
+        slot = &r->slots[r->cursor & r->mask];
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if ( seq == r->cursor ) {
+            len = slot->len <= size ? slot->len : size;
+            memcpy(buf, slot->data, len);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if ( __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == r->cursor )
+                break;
+        }
+        //--- писатель перезаписывает ячейку прямо сейчас: перечитываем head и прыгаем вперед
+        cpu_relax();
+    }
+
+    r->cursor++;
+    if ( r->reader ) {
+        if ( *lost )
+            __atomic_fetch_add(&r->reader->lost, *lost, __ATOMIC_RELAXED);
+        __atomic_store_n(&r->reader->cursor, r->cursor, __ATOMIC_RELEASE);
+        if ( r->hdr->flags & BCAST_GATED )
+            shm_event_notify(&r->hdr->progress);
+    }
+    return len;
+}
+
+//--- Блокирующее чтение: недолго крутимся, затем засыпаем до следующей публикации
+static inline int bcast_ring_recv(struct bcast_ring *r, void *buf, uint32_t size, uint64_t *lost) {
+    int spin = SHM_EVENT_SPIN, len;
+    uint32_t seq;
+
+    while ( (len = bcast_ring_read(r, buf, size, lost)) == -1 ) {
+        if ( spin-- > 0 ) {
+            cpu_relax();
+            continue;
+        }
+        seq = shm_event_prepare_wait(&r->hdr->published);
+        if ( (len = bcast_ring_read(r, buf, size, lost)) >= 0 ) {
+            shm_event_cancel_wait(&r->hdr->published);
+            break;
+        }
+        shm_event_wait(&r->hdr->published, seq);
+    }
+    return len;
+}
+
+#endif
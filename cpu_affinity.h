@@ -0,0 +1,269 @@
+#ifndef CPU_AFFINITY_H
+#define CPU_AFFINITY_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // sched_setaffinity(), pthread_attr_setaffinity_np()
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+
+//--- Привязка потоков и процессов к процессорам. Задержка передачи между производителем
+//--- и потребителем сильно зависит от того, где они работают: на двух гиперпотоках одного
+//--- ядра (общие L1/L2, но и общие исполнительные блоки), на разных ядрах с общим L3
+//--- или на разных сокетах, где каждая строка кэша идет через межпроцессорную шину.
+//---
+//--- Спецификация - ключ --cpus или переменная окружения IPC_CPUS:
+//---     0,2-3   явный список: процессоры раздаются по кругу в порядке создания
+//---     pair    два разных ядра с общим кэшем последнего уровня
+//---     smt     два гиперпотока одного ядра
+//---     remote  два процессора с разными кэшами последнего уровня (по возможности - сокетами)
+//--- Топология читается из /sys/devices/system/cpu; учитываются только процессоры,
+//--- разрешенные процессу (sched_getaffinity), например, в контейнере.
+
+#define CPU_AFFINITY_ENV   "IPC_CPUS"
+#define CPU_AFFINITY_MAX   64   // процессоров в одной спецификации
+#define CPU_TOPOLOGY_MAX   1024 // как CPU_SETSIZE
+
+struct cpu_info {
+    int package; // physical_package_id
+    int core;    // первый процессор ядра (thread_siblings_list)
+    int llc;     // первый процессор, с которым общий кэш последнего уровня
+    int llc_level;
+};
+
+struct cpu_affinity {
+    int n;                          // 0 - без привязки
+    int cpus[CPU_AFFINITY_MAX];
+    int next;
+    int ncpus;                      // процессоров в топологии
+    struct cpu_info info[CPU_TOPOLOGY_MAX]; // -1 в package - процессор недоступен
+};
+
+//--- Первое число из файла sysfs (для списков "0-3,8" - первый процессор списка)
+static inline int cpu_sysfs_int(int cpu, const char *file) {
+    char path[128];
+    FILE *f;
+    int v = -1;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", cpu, file);
+    if ( (f = fopen(path, "r")) == NULL )
+        return -1;
+    if ( fscanf(f, "%d", &v) != 1 )
+        v = -1;
+    fclose(f);
+    return v;
+}
+
+static inline void cpu_topology_load(struct cpu_affinity *a) {
+    cpu_set_t allowed;
+    char file[64];
+    int cpu, i, level;
+
+    CPU_ZERO(&allowed);
+    if ( sched_getaffinity(0, sizeof(allowed), &allowed) == -1 )
+        perror("sched_getaffinity");
+    a->ncpus = 0;
+    for ( cpu = 0; cpu < CPU_TOPOLOGY_MAX; cpu++ ) {
+        struct cpu_info *ci = &a->info[cpu];
+
+        ci->package = -1;
+        if ( !CPU_ISSET(cpu, &allowed) )
+            continue;
+        ci->package = cpu_sysfs_int(cpu, "topology/physical_package_id");
+        if ( (ci->core = cpu_sysfs_int(cpu, "topology/thread_siblings_list")) == -1 )
+            ci->core = cpu;
+        ci->llc = ci->core;
+        ci->llc_level = 0;
+        //--- кэш последнего уровня - общий кэш с наибольшим level
+        for ( i = 0; i < 8; i++ ) {
+            snprintf(file, sizeof(file), "cache/index%d/level", i);
+            if ( (level = cpu_sysfs_int(cpu, file)) == -1 )
+                break;
+            if ( level > ci->llc_level ) {
+                snprintf(file, sizeof(file), "cache/index%d/shared_cpu_list", i);
+                ci->llc = cpu_sysfs_int(cpu, file);
+                ci->llc_level = level;
+            }
+        }
+        if ( ci->package == -1 )
+            ci->package = 0;
+        a->ncpus = cpu + 1;
+    }
+}
+
+static inline int cpu_usable(const struct cpu_affinity *a, int cpu) {
+    return cpu >= 0 && cpu < a->ncpus && a->info[cpu].package != -1;
+}
+
+//--- Пара процессоров под условие: 0 - smt, 1 - pair, 2 - remote
+static inline int cpu_affinity_pick_pair(struct cpu_affinity *a, int kind) {
+    int x, y, best = -1, by = -1, score, best_score = 0;
+    const struct cpu_info *p, *q;
+
+    for ( x = 0; x < a->ncpus; x++ ) {
+        for ( y = x + 1; y < a->ncpus; y++ ) {
+            if ( !cpu_usable(a, x) || !cpu_usable(a, y) )
+                continue;
+            p = &a->info[x];
+            q = &a->info[y];
+            if ( kind == 0 && p->core == q->core )
+                score = 1;
+            else if ( kind == 1 && p->core != q->core && p->llc == q->llc )
+                score = 1;
+            else if ( kind == 2 && p->llc != q->llc )
+                score = p->package != q->package ? 2 : 1; // разные сокеты лучше
+            else
+                continue;
+            if ( score > best_score ) {
+                best = x;
+                by = y;
+                best_score = score;
+            }
+        }
+    }
+    if ( best == -1 )
+        return -1;
+    a->cpus[0] = best;
+    a->cpus[1] = by;
+    a->n = 2;
+    return 0;
+}
+
+//--- Разбирает спецификацию (см. начало файла). NULL или "" - без привязки.
+static inline int cpu_affinity_parse(struct cpu_affinity *a, const char *spec) {
+    const char *p = spec;
+    char *end;
+    long from, to, cpu;
+
+    a->n = a->next = 0;
+    cpu_topology_load(a);
+    if ( !spec || !*spec )
+        return 0;
+    if ( !strcmp(spec, "smt") || !strcmp(spec, "pair") || !strcmp(spec, "remote") ) {
+        if ( cpu_affinity_pick_pair(a, spec[0] == 's' ? 0 : spec[0] == 'p' ? 1 : 2) == -1 ) {
+            fprintf(stderr, "cpu affinity: no two allowed CPUs match '%s', threads are not pinned\n", spec);
+            a->n = 0;
+        }
+        return 0;
+    }
+    while ( *p ) {
+        from = to = strtol(p, &end, 10);
+        if ( end == p )
+            break;
+        if ( *end == '-' ) {
+            p = end + 1;
+            to = strtol(p, &end, 10);
+            if ( end == p )
+                break;
+        }
+        for ( cpu = from; cpu <= to && a->n < CPU_AFFINITY_MAX; cpu++ ) {
+            if ( !cpu_usable(a, cpu) ) {
+                fprintf(stderr, "cpu affinity: CPU %ld is not available\n", cpu);
+                return -1;
+            }
+            a->cpus[a->n++] = cpu;
+        }
+        if ( *end != ',' ) {
+            p = end;
+            break;
+        }
+        p = end + 1;
+    }
+    if ( *p || !a->n ) {
+        fprintf(stderr, "cpu affinity: bad CPU list '%s'\n", spec);
+        return -1;
+    }
+    return 0;
+}
+
+//--- Печатает топологию и выбранные процессоры
+static inline void cpu_affinity_report(const struct cpu_affinity *a, FILE *out) {
+    int cpu, i, packages = 0, cores = 0, llcs = 0, online = 0;
+    const struct cpu_info *ci;
+
+    for ( cpu = 0; cpu < a->ncpus; cpu++ ) {
+        if ( !cpu_usable(a, cpu) )
+            continue;
+        ci = &a->info[cpu];
+        online++;
+        cores += ci->core == cpu;
+        llcs += ci->llc == cpu;
+        packages = ci->package + 1 > packages ? ci->package + 1 : packages;
+    }
+    fprintf(out, "# topology: %d CPUs allowed, %d packages, %d cores, %d last-level caches\n",
+            online, packages, cores, llcs);
+    if ( !a->n ) {
+        fprintf(out, "# affinity: not pinned (use --cpus or %s)\n", CPU_AFFINITY_ENV);
+        return;
+    }
+    for ( i = 0; i < a->n; i++ ) {
+        ci = &a->info[a->cpus[i]];
+        fprintf(out, "# affinity: #%d -> cpu %d (package %d, core %d, L%d shared from cpu %d)\n",
+                i, a->cpus[i], ci->package, ci->core, ci->llc_level, ci->llc);
+    }
+}
+
+//--- Убирает из argv ключ --cpus SPEC; без него берется IPC_CPUS. Печатает топологию в stderr.
+static inline int cpu_affinity_init(struct cpu_affinity *a, int *argc, char **argv) {
+    const char *spec = getenv(CPU_AFFINITY_ENV);
+    int i, j;
+
+    for ( i = 1; i < *argc; i++ ) {
+        if ( strcmp(argv[i], "--cpus") || i + 1 >= *argc )
+            continue;
+        spec = argv[i + 1];
+        for ( j = i; j + 2 <= *argc; j++ )
+            argv[j] = argv[j + 2];
+        *argc -= 2;
+        break;
+    }
+    if ( cpu_affinity_parse(a, spec) == -1 )
+        return -1;
+    cpu_affinity_report(a, stderr);
+    return 0;
+}
+
+//--- Следующий процессор по кругу или -1, если привязки нет
+static inline int cpu_affinity_next(struct cpu_affinity *a) {
+    if ( !a->n )
+        return -1;
+    return a->cpus[a->next++ % a->n];
+}
+
+//--- Привязывает вызывающий поток (после fork() - процесс-потомок) к процессору cpu
+static inline int cpu_affinity_pin_self(int cpu) {
+    cpu_set_t set;
+    int rc;
+
+    if ( cpu < 0 )
+        return 0;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if ( (rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) ) {
+        fprintf(stderr, "pthread_setaffinity_np(%d): %s\n", cpu, strerror(rc));
+        return -1;
+    }
+    return 0;
+}
+
+//--- Атрибуты потока, который сразу начнет работать на процессоре cpu
+static inline int cpu_affinity_attr(pthread_attr_t *attr, int cpu) {
+    cpu_set_t set;
+    int rc;
+
+    pthread_attr_init(attr);
+    if ( cpu < 0 )
+        return 0;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if ( (rc = pthread_attr_setaffinity_np(attr, sizeof(set), &set)) ) {
+        fprintf(stderr, "pthread_attr_setaffinity_np(%d): %s\n", cpu, strerror(rc));
+        return -1;
+    }
+    return 0;
+}
+
+#endif
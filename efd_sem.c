@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "ipc_common.h"
+#include "fifo_frame.h"
+#include "fd_pass.h"
+#include "efd_sem.h"
+
+#define EFD_SEM_SOCKET "/tmp/my_efd_sem.sock"
+#define EFD_SEM_FIFO   "/tmp/my_efd_fifo"
+#define EFD_SEM_BATCH  64 // сколько единиц сервер забирает за один раз
+#define MAX_EVENTS     16
+
+void usage(const char * s) {
+    printf("Usage: %s <server [sem]|post n|wait n|bench count batch [sem]>\n", s);
+}
+
+static volatile sig_atomic_t stop_server;
+
+void on_signal(int sig) {
+    stop_server = 1;
+}
+
+void on_frame(const char *data, uint32_t len, void *arg) {
+    printf("Incomming message (%u): %.*s\n", len, (int)len, data);
+}
+
+static int unix_socket(struct sockaddr_un *addr) {
+    int sock;
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strncpy(addr->sun_path, EFD_SEM_SOCKET, sizeof(addr->sun_path) - 1);
+    if ( (sock = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0)) == -1 )
+        perror("socket");
+    return sock;
+}
+
+//--- Подключается к серверу и получает от него дескриптор семафора
+static int connect_sem(struct efd_sem *s) {
+    struct sockaddr_un addr;
+    char mode;
+    int sock, fd;
+
+    if ( (sock = unix_socket(&addr)) == -1 )
+        return -1;
+    if ( connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1 ) {
+        perror(EFD_SEM_SOCKET);
+        close(sock);
+        return -1;
+    }
+    fd = fd_pass_recv(sock, &mode, 1);
+    close(sock);
+    if ( fd == -1 ) {
+        perror("fd_pass_recv");
+        return -1;
+    }
+    return efd_sem_attach(s, fd, mode);
+}
+
+static int epoll_add(int epfd, int fd) {
+    struct epoll_event ev;
+
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if ( epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1 ) {
+        perror("epoll_ctl");
+        return -1;
+    }
+    return 0;
+}
+
+//--- Один поток и один epoll на три источника: семафор, канал с кадрами
+//--- и сокет, через который клиенты получают дескриптор семафора
+static int run_server(int mode) {
+    struct epoll_event events[MAX_EVENTS];
+    struct fifo_frame_reader *reader;
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    struct efd_sem sem;
+    int epfd, lsock, fifo, wfifo, conn, i, n, fd;
+    long got, total = 0;
+    char m = mode;
+    ssize_t len;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    if ( (reader = (struct fifo_frame_reader *)malloc(sizeof(*reader))) == NULL ) {
+        perror("malloc");
+        return 1;
+    }
+    fifo_frame_reader_init(reader);
+    if ( efd_sem_init(&sem, 0, mode) == -1 ) {
+        perror("eventfd");
+        return 1;
+    }
+    if ( mkfifo(EFD_SEM_FIFO, 0777) && errno != EEXIST ) {
+        perror(EFD_SEM_FIFO);
+        return 1;
+    }
+    //--- свой пишущий конец держим открытым, чтобы уход писателя не давал EOF
+    if ( (fifo = open(EFD_SEM_FIFO, O_RDONLY|O_NONBLOCK)) == -1 ||
+         (wfifo = open(EFD_SEM_FIFO, O_WRONLY|O_NONBLOCK)) == -1 ) {
+        perror(EFD_SEM_FIFO);
+        return 1;
+    }
+    if ( (lsock = unix_socket(&addr)) == -1 )
+        return 1;
+    unlink(EFD_SEM_SOCKET);
+    if ( bind(lsock, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(lsock, 16) == -1 ) {
+        perror(EFD_SEM_SOCKET);
+        return 1;
+    }
+    if ( (epfd = epoll_create1(EPOLL_CLOEXEC)) == -1 ) {
+        perror("epoll_create1");
+        return 1;
+    }
+    if ( epoll_add(epfd, efd_sem_fd(&sem)) == -1 || epoll_add(epfd, fifo) == -1 || epoll_add(epfd, lsock) == -1 )
+        return 1;
+    printf("Semaphore (%s mode) is served on %s, messages are read from %s\n",
+           mode == EFD_SEM_SEMAPHORE ? "semaphore" : "counter", EFD_SEM_SOCKET, EFD_SEM_FIFO);
+
+    while ( !stop_server ) {
+        if ( (n = epoll_wait(epfd, events, MAX_EVENTS, -1)) == -1 ) {
+            if ( errno == EINTR )
+                continue;
+            perror("epoll_wait");
+            break;
+        }
+        for ( i = 0; i < n; i++ ) {
+            fd = events[i].data.fd;
+            if ( fd == efd_sem_fd(&sem) ) {
+                if ( (got = efd_sem_try_wait_many(&sem, EFD_SEM_BATCH)) > 0 ) {
+                    total += got;
+                    printf("Took %ld credits (%ld total)\n", got, total);
+                }
+            } else if ( fd == fifo ) {
+                while ( (len = fifo_frame_read(fifo, reader, on_frame, NULL)) > 0 )
+                    ;
+                if ( len == -1 && errno == EPROTO )
+                    fifo_frame_reader_init(reader);
+            } else if ( (conn = accept4(lsock, NULL, NULL, SOCK_CLOEXEC)) != -1 ) {
+                if ( fd_pass_send(conn, efd_sem_fd(&sem), &m, 1) == -1 )
+                    perror("fd_pass_send");
+                close(conn);
+            }
+        }
+    }
+    printf("Took %ld credits\n", total);
+
+    close(epfd);
+    close(lsock);
+    unlink(EFD_SEM_SOCKET);
+    close(fifo);
+    close(wfifo);
+    remove(EFD_SEM_FIFO);
+    efd_sem_close(&sem);
+    free(reader);
+    return 0;
+}
+
+//--- Производитель отдает count единиц пачками по batch, потребитель забирает их
+//--- тоже пачками: на пачку - один write() и, в режиме счетчика, один read()
+static int bench(long count, long batch, int mode) {
+    struct efd_sem sem;
+    long got, done, calls = 0;
+    uint64_t start, ns;
+    pid_t pid;
+
+    if ( efd_sem_init(&sem, 0, mode) == -1 ) {
+        perror("eventfd");
+        return 1;
+    }
+    start = now_ns();
+    if ( (pid = fork()) == -1 ) {
+        perror("fork");
+        return 1;
+    }
+    if ( pid == 0 ) {
+        for ( done = 0; done < count; done += batch )
+            efd_sem_post(&sem, count - done < batch ? count - done : batch);
+        _exit(0);
+    }
+    for ( done = 0; done < count; done += got, calls++ )
+        if ( (got = efd_sem_wait_many(&sem, batch, -1)) == -1 ) {
+            perror("efd_sem_wait_many");
+            break;
+        }
+    ns = now_ns() - start;
+    waitpid(pid, NULL, 0);
+    printf("%ld credits in %.3f s (%.0f credits/s), %ld waits, %.1f credits per wait\n",
+           done, ns / 1e9, done * 1e9 / ns, calls, calls ? (double)done / calls : 0.0);
+    efd_sem_close(&sem);
+    return 0;
+}
+
+int main (int argc, char ** argv) {
+    struct efd_sem sem;
+    int mode;
+    long n;
+
+    mode = !strcmp(argv[argc - 1], "sem") ? EFD_SEM_SEMAPHORE : EFD_SEM_COUNTER;
+    if ( argc >= 2 && !strcmp(argv[1], "server") && argc <= 3 )
+        return run_server(mode);
+    if ( argc >= 4 && argc <= 5 && !strcmp(argv[1], "bench") && atol(argv[2]) > 0 && atol(argv[3]) > 0 )
+        return bench(atol(argv[2]), atol(argv[3]), mode);
+    if ( argc != 3 || (strcmp(argv[1], "post") && strcmp(argv[1], "wait")) || (n = atol(argv[2])) <= 0 ) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if ( connect_sem(&sem) == -1 )
+        return 1;
+    if ( !strcmp(argv[1], "post") ) {
+        if ( efd_sem_post(&sem, n) == -1 )
+            perror("efd_sem_post");
+        else
+            printf("Posted %ld credits\n", n);
+    } else {
+        //--- соревнуемся за единицы с сервером: кто первым прочитает, тот и забрал
+        printf("Waiting for %ld credits...\n", n);
+        if ( (n = efd_sem_wait_many(&sem, n, -1)) > 0 )
+            printf("Took %ld credits\n", n);
+    }
+    efd_sem_close(&sem);
+    return 0;
+}
+
+/*
+Семафор на eventfd
+
+В sem_open.c семафор - именованный sem_t: каждая единица отдается и забирается
+отдельным вызовом, а ждать его можно только в sem_wait(), т.е. поток, обслуживающий
+каналы через epoll, не может одновременно ждать и семафор.
+
+Здесь семафор - счетчик eventfd (efd_sem.h):
+
+    efd_sem_post(n)          - добавить n единиц одним write();
+    efd_sem_try_wait_many(n) - забрать до n единиц, не блокируясь;
+    efd_sem_wait_many(n)     - дождаться хотя бы одной и забрать до n;
+    efd_sem_fd()             - дескриптор для epoll: EPOLLIN, пока счетчик больше нуля.
+
+Режим счетчика (по умолчанию) забирает пачку одним read(); режим sem (EFD_SEMAPHORE)
+отдает по одной единице на read(), зато не требует возврата излишка.
+
+У eventfd нет имени, поэтому другой процесс получает семафор как дескриптор:
+сервер раздает его через сокет UNIX (SCM_RIGHTS, fd_pass.h), а после fork() дескриптор
+наследуется сам. Сервер ждет в одном epoll семафор, именованный канал с кадрами
+(fifo_frame.h) и подключения клиентов.
+
+Компилируем:
+
+$ g++ -O2 -o efd_sem efd_sem.c -pthread
+
+$ ./efd_sem server
+Semaphore (counter mode) is served on /tmp/my_efd_sem.sock, messages are read from /tmp/my_efd_fifo
+
+В соседних окнах:
+
+$ ./efd_sem post 100
+Posted 100 credits
+$ ./mkfifo send 'Hello' 3 /tmp/my_efd_fifo
+
+Сервер забирает единицы пачками не больше 64:
+
+Took 64 credits (64 total)
+Took 36 credits (100 total)
+Incomming message (5): Hello
+...
+
+Пачки против поштучной выдачи:
+
+$ ./efd_sem bench 10000000 1000
+$ ./efd_sem bench 10000000 1000 sem
+*/
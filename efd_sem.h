@@ -0,0 +1,129 @@
+#ifndef EFD_SEM_H
+#define EFD_SEM_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+//--- Счетный семафор на eventfd. Значение семафора - счетчик eventfd в ядре,
+//--- дескриптор открыт с EFD_NONBLOCK, поэтому его можно добавить в epoll/poll
+//--- рядом с каналами и сокетами: он "читаем", пока счетчик больше нуля.
+//--- Между процессами семафор передается как дескриптор: через fork() или SCM_RIGHTS (fd_pass.h).
+//---
+//--- Два режима:
+//---   EFD_SEM_COUNTER   - read() забирает весь счетчик сразу: пачку единиц за один вызов;
+//---   EFD_SEM_SEMAPHORE - EFD_SEMAPHORE, read() забирает ровно одну единицу.
+//--- post(n) в обоих режимах - один write().
+
+#define EFD_SEM_COUNTER   0
+#define EFD_SEM_SEMAPHORE 1
+
+struct efd_sem {
+    int fd;
+    int mode;
+};
+
+static inline int efd_sem_init(struct efd_sem *s, unsigned value, int mode) {
+    s->mode = mode;
+    s->fd = eventfd(value, EFD_NONBLOCK|EFD_CLOEXEC|(mode == EFD_SEM_SEMAPHORE ? EFD_SEMAPHORE : 0));
+    return s->fd == -1 ? -1 : 0;
+}
+
+//--- Семафор из дескриптора, полученного от другого процесса. mode должен совпадать
+//--- с режимом создателя: от него зависит только то, сколько мы просим у read().
+static inline int efd_sem_attach(struct efd_sem *s, int fd, int mode) {
+    int fl;
+
+    if ( (fl = fcntl(fd, F_GETFL)) == -1 || fcntl(fd, F_SETFL, fl|O_NONBLOCK) == -1 )
+        return -1;
+    s->fd = fd;
+    s->mode = mode;
+    return 0;
+}
+
+static inline void efd_sem_close(struct efd_sem *s) {
+    if ( s->fd != -1 )
+        close(s->fd);
+    s->fd = -1;
+}
+
+//--- Дескриптор для epoll/poll (EPOLLIN - есть хотя бы одна единица)
+static inline int efd_sem_fd(const struct efd_sem *s) {
+    return s->fd;
+}
+
+//--- Добавляет n единиц одним системным вызовом
+static inline int efd_sem_post(struct efd_sem *s, uint64_t n) {
+    while ( write(s->fd, &n, sizeof(n)) == -1 ) {
+        if ( errno != EINTR )
+            return -1;
+    }
+    return 0;
+}
+
+//--- Забирает до max единиц не блокируясь. Возвращает число взятых единиц (0 - семафор пуст)
+//--- или -1 при ошибке. В режиме счетчика read() обнуляет счетчик целиком, и излишек
+//--- сверх max возвращается обратно вторым write(); соседи, успевшие увидеть ноль, будут
+//--- разбужены этим write(). В режиме EFD_SEMAPHORE на каждую единицу - свой read().
+//--- Взятые единицы не теряются: если излишек вернуть не удалось, max единиц все равно
+//--- достаются вызывающему.
+static inline long efd_sem_try_wait_many(struct efd_sem *s, uint64_t max) {
+    uint64_t v, got = 0;
+
+    while ( got < max ) {
+        if ( read(s->fd, &v, sizeof(v)) == -1 ) {
+            if ( errno == EINTR )
+                continue;
+            if ( errno == EAGAIN )
+                break;
+            return -1;
+        }
+        if ( s->mode == EFD_SEM_SEMAPHORE ) {
+            got++;
+            continue;
+        }
+        if ( v > max - got ) {
+            //--- EAGAIN - счетчик переполнился бы: ждем, пока соседи разберут единицы
+            while ( efd_sem_post(s, v - (max - got)) == -1 && errno == EAGAIN )
+                sched_yield();
+            v = max - got;
+        }
+        got += v;
+        break;
+    }
+    return (long)got;
+}
+
+static inline int efd_sem_try_wait(struct efd_sem *s) {
+    return efd_sem_try_wait_many(s, 1) == 1 ? 0 : -1;
+}
+
+//--- Ждет хотя бы одну единицу и забирает до max. timeout_ms < 0 - без ограничения.
+//--- Возвращает число взятых единиц, 0 - по истечении времени, -1 - ошибка.
+static inline long efd_sem_wait_many(struct efd_sem *s, uint64_t max, int timeout_ms) {
+    struct pollfd pfd;
+    long got;
+    int rc;
+
+    pfd.fd = s->fd;
+    pfd.events = POLLIN;
+    for ( ;; ) {
+        if ( (got = efd_sem_try_wait_many(s, max)) != 0 )
+            return got;
+        //--- единицы мог забрать соседний ожидающий - тогда засыпаем снова
+        if ( (rc = poll(&pfd, 1, timeout_ms)) == 0 )
+            return 0;
+        if ( rc == -1 && errno != EINTR )
+            return -1;
+    }
+}
+
+static inline int efd_sem_wait(struct efd_sem *s) {
+    return efd_sem_wait_many(s, 1, -1) == 1 ? 0 : -1;
+}
+
+#endif
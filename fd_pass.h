@@ -0,0 +1,89 @@
+#ifndef FD_PASS_H
+#define FD_PASS_H
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+//--- Передача открытых дескрипторов между неродственными процессами через сокет UNIX
+//--- (SCM_RIGHTS). Получатель получает свой дескриптор на тот же открытый файл ядра:
+//--- eventfd, memfd, канал и т.п. Вместе с дескриптором идет небольшое сообщение data.
+
+//--- Отправляет fd и len байт data (len > 0: пустое сообщение SOCK_STREAM не передает)
+static inline int fd_pass_send(int sock, int fd, const void *data, size_t len) {
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cm;
+    union {
+        char           buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } ctl;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&ctl, 0, sizeof(ctl));
+    iov.iov_base = (void *)data;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+    cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+
+    while ( sendmsg(sock, &msg, MSG_NOSIGNAL) == -1 ) {
+        if ( errno != EINTR )
+            return -1;
+    }
+    return 0;
+}
+
+//--- Принимает сообщение (до len байт в data) и дескриптор, если он пришел вместе с ним:
+//--- *fd = -1, если дескриптора нет. Возвращает длину сообщения, 0 - соединение закрыто, -1 - ошибка.
+static inline ssize_t fd_pass_recvmsg(int sock, void *data, size_t len, int *fd) {
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cm;
+    union {
+        char           buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } ctl;
+    ssize_t n;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = data;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+
+    *fd = -1;
+    while ( (n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) == -1 ) {
+        if ( errno != EINTR )
+            return -1;
+    }
+    for ( cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm) )
+        if ( cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS )
+            memcpy(fd, CMSG_DATA(cm), sizeof(int));
+    return n;
+}
+
+//--- Принимает дескриптор и до len байт сообщения в data. Возвращает новый дескриптор
+//--- (с O_CLOEXEC) или -1; errno = EBADMSG, если сообщение пришло без дескриптора.
+static inline int fd_pass_recv(int sock, void *data, size_t len) {
+    ssize_t n;
+    int fd;
+
+    if ( (n = fd_pass_recvmsg(sock, data, len, &fd)) == -1 )
+        return -1;
+    if ( fd == -1 )
+        errno = n == 0 ? ECONNRESET : EBADMSG;
+    return fd;
+}
+
+#endif
@@ -0,0 +1,168 @@
+#ifndef FIFO_FRAME_H
+#define FIFO_FRAME_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include "ipc_common.h"
+
+//--- Кадрированный поток в именованном канале: каждое сообщение предваряется
+//--- двоичным заголовком с длиной. Читатель забирает из канала сразу много
+//--- кадров одним read() в большой буфер и разбирает их на месте, без копирования.
+
+#define FIFO_FRAME_BUFSIZE (64 * 1024)
+#define FIFO_FRAME_MAX     (FIFO_FRAME_BUFSIZE - sizeof(struct fifo_frame_hdr))
+
+struct fifo_frame_hdr {
+    uint32_t len; // длина полезной нагрузки в байтах
+};
+
+//--- Вызывается для каждого полного кадра. data указывает прямо в буфер приема
+//--- и действительна только до возврата из функции.
+typedef void (*fifo_frame_cb)(const char *data, uint32_t len, void *arg);
+
+//--- Буфер приема. Байты [start, end) - еще не разобранные данные.
+struct fifo_frame_reader {
+    char   buf[FIFO_FRAME_BUFSIZE];
+    size_t start;
+    size_t end;
+};
+
+static inline void fifo_frame_reader_init(struct fifo_frame_reader *r) {
+    r->start = 0;
+    r->end = 0;
+}
+
+//--- Разбирает все полные кадры, находящиеся в буфере.
+//--- Возвращает 0 или -1, если заголовок содержит недопустимую длину.
+static inline int fifo_frame_parse(struct fifo_frame_reader *r, fifo_frame_cb cb, void *arg) {
+    struct fifo_frame_hdr hdr;
+    size_t need = sizeof(hdr); // сколько байт нужно для следующего кадра
+
+    while ( r->end - r->start >= sizeof(hdr) ) {
+        memcpy(&hdr, r->buf + r->start, sizeof(hdr)); // заголовок может быть не выровнен
+        if ( hdr.len > FIFO_FRAME_MAX ) {
+            errno = EPROTO;
+            return -1;
+        }
+        need = sizeof(hdr) + hdr.len;
+        if ( r->end - r->start < need )
+            break; // кадр пришел не целиком, дочитаем в следующий раз
+        cb(r->buf + r->start + sizeof(hdr), hdr.len, arg);
+        r->start += need;
+        need = sizeof(hdr);
+    }
+
+    //--- Буфер разобран полностью - начинаем с начала. Хвост переносим в начало,
+    //--- только когда недостающий кадр не помещается до конца буфера,
+    //--- так что memmove случается редко.
+    if ( r->start == r->end ) {
+        r->start = r->end = 0;
+    } else if ( r->start + need > sizeof(r->buf) ) {
+        memmove(r->buf, r->buf + r->start, r->end - r->start);
+        r->end -= r->start;
+        r->start = 0;
+    }
+    return 0;
+}
+
+//--- В буфер по адресу buf + end пришло len байт (через read() или асинхронно) - разбираем их
+static inline int fifo_frame_received(struct fifo_frame_reader *r, size_t len, fifo_frame_cb cb, void *arg) {
+    r->end += len;
+    return fifo_frame_parse(r, cb, arg);
+}
+
+//--- Один read() из канала и разбор всех полученных кадров.
+//--- Возвращает число прочитанных байт, 0 при EOF или -1 при ошибке.
+static inline ssize_t fifo_frame_read(int fd, struct fifo_frame_reader *r, fifo_frame_cb cb, void *arg) {
+    ssize_t len;
+
+    if ( (len = read(fd, r->buf + r->end, sizeof(r->buf) - r->end)) <= 0 )
+        return len;
+    if ( fifo_frame_received(r, len, cb, arg) == -1 )
+        return -1;
+    return len;
+}
+
+//--- Записывает один кадр. Кадры не длиннее PIPE_BUF (вместе с заголовком)
+//--- пишутся в канал атомарно и не перемешиваются с кадрами других писателей.
+static inline int fifo_frame_write(int fd, const void *data, uint32_t len) {
+    struct fifo_frame_hdr hdr;
+    struct iovec iov[2];
+
+    if ( len > FIFO_FRAME_MAX ) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    hdr.len = len;
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len = sizeof(hdr);
+    iov[1].iov_base = (void *)data;
+    iov[1].iov_len = len;
+    if ( writev(fd, iov, 2) != (ssize_t)(sizeof(hdr) + len) )
+        return -1;
+    return 0;
+}
+
+//--- Итоги читателя кадров. Обработчики пула (str_mkfifo.c) увеличивают их атомарно.
+struct fifo_frame_stats {
+    long          frames;
+    long          bytes;
+    int           verbose;
+    fifo_frame_cb print;   // с verbose вызывается для каждого кадра; печатает вызывающий
+};
+
+//--- Обработчик кадра для fifo_frame_read(): считает кадры, с verbose - отдает их print
+static inline void fifo_frame_count(const char *data, uint32_t len, void *arg) {
+    struct fifo_frame_stats *st = (struct fifo_frame_stats *)arg;
+
+    st->frames++;
+    st->bytes += len;
+    if ( st->verbose && st->print )
+        st->print(data, len, NULL);
+}
+
+//--- Писатель кадрированного потока: отправляет text count раз в канал path
+static inline int fifo_frame_send(const char *path, const char *text, long count) {
+    int fd;
+    long i;
+    uint32_t len = strlen(text);
+
+    if ( (fd = open(path, O_WRONLY)) == -1 ) {
+        perror("open");
+        return 1;
+    }
+    for ( i = 0; i < count; i++ ) {
+        if ( fifo_frame_write(fd, text, len) == -1 ) {
+            perror("write");
+            close(fd);
+            return 1;
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+//--- Читатель кадрированного потока до EOF: один read() забирает до 64 КиБ, т.е. много
+//--- кадров сразу. В *ns - время от первых данных до EOF. Возвращает 0 или -1 при ошибке.
+static inline ssize_t fifo_frame_drain(int fd, struct fifo_frame_stats *st, uint64_t *ns) {
+    static struct fifo_frame_reader reader;
+    ssize_t len;
+    uint64_t start = 0;
+
+    fifo_frame_reader_init(&reader);
+    while ( (len = fifo_frame_read(fd, &reader, fifo_frame_count, st)) > 0 ) {
+        if ( !start )
+            start = now_ns();
+    }
+    if ( len < 0 )
+        perror("read");
+    *ns = start ? now_ns() - start : 0;
+    return len;
+}
+
+#endif
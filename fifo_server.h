@@ -0,0 +1,150 @@
+#ifndef FIFO_SERVER_H
+#define FIFO_SERVER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include "fifo_frame.h"
+
+//--- Сервер на N именованных каналах в одном потоке: каналы открываются с O_NONBLOCK
+//--- и опрашиваются через epoll в режиме edge-triggered. В каждом канале - кадрированный
+//--- поток (fifo_frame.h), у каждого канала свой буфер приема.
+
+#define FIFO_SERVER_PATH_MAX 108
+#define FIFO_SERVER_EVENTS   64
+
+struct fifo_conn {
+    int    fd;   // читающий конец
+    int    wfd;  // свой пишущий конец: канал не получает EOF, когда уходит последний писатель
+    char   path[FIFO_SERVER_PATH_MAX];
+    long   bytes;
+    struct fifo_frame_reader reader;
+};
+
+struct fifo_server {
+    int               epfd;
+    int               count;
+    struct fifo_conn *conns;
+    fifo_frame_cb     cb;
+    void             *arg;
+};
+
+//--- Создает каналы prefix.0 ... prefix.(count-1) и регистрирует их в epoll
+static inline int fifo_server_open(struct fifo_server *srv, const char *prefix, int count,
+                                   fifo_frame_cb cb, void *arg) {
+    struct epoll_event ev;
+    struct fifo_conn *c;
+    int i;
+
+    //--- fifo_server_close() вызывается и после неудачного open: все поля - до первой ошибки
+    srv->epfd = -1;
+    srv->conns = NULL;
+    srv->count = 0;
+    srv->cb = cb;
+    srv->arg = arg;
+    if ( (srv->conns = (struct fifo_conn *)calloc(count, sizeof(struct fifo_conn))) == NULL ) {
+        perror("calloc");
+        return -1;
+    }
+    if ( (srv->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1 ) {
+        perror("epoll_create1");
+        return -1;
+    }
+
+    for ( i = 0; i < count; i++ ) {
+        c = &srv->conns[i];
+        snprintf(c->path, sizeof(c->path), "%s.%d", prefix, i);
+        if ( mkfifo(c->path, 0777) && errno != EEXIST ) {
+            perror(c->path);
+            return -1;
+        }
+        //--- с O_NONBLOCK open() на чтение не ждет писателя, а после этого
+        //--- open() на запись тоже проходит сразу
+        if ( (c->fd = open(c->path, O_RDONLY|O_NONBLOCK)) == -1 ) {
+            perror(c->path);
+            remove(c->path);
+            return -1;
+        }
+        if ( (c->wfd = open(c->path, O_WRONLY|O_NONBLOCK)) == -1 ) {
+            perror(c->path);
+            close(c->fd);
+            remove(c->path);
+            return -1;
+        }
+        fifo_frame_reader_init(&c->reader);
+        srv->count++;
+
+        ev.events = EPOLLIN|EPOLLET;
+        ev.data.ptr = c;
+        if ( epoll_ctl(srv->epfd, EPOLL_CTL_ADD, c->fd, &ev) == -1 ) {
+            perror("epoll_ctl");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+//--- В режиме edge-triggered уведомление приходит один раз, поэтому канал
+//--- вычитывается до EAGAIN. Возвращает -1 только при ошибке канала.
+static inline int fifo_server_drain(struct fifo_server *srv, struct fifo_conn *c) {
+    ssize_t len;
+
+    for ( ;; ) {
+        if ( (len = fifo_frame_read(c->fd, &c->reader, srv->cb, srv->arg)) > 0 ) {
+            c->bytes += len;
+            continue;
+        }
+        if ( len == -1 && errno == EAGAIN )
+            return 0;
+        if ( len == -1 && errno == EPROTO ) {
+            //--- писатель прислал мусор: сбрасываем буфер и продолжаем обслуживать канал
+            fprintf(stderr, "%s: bad frame, dropping buffered data\n", c->path);
+            fifo_frame_reader_init(&c->reader);
+            continue;
+        }
+        if ( len == -1 && errno == EINTR )
+            continue;
+        perror(c->path);
+        return -1;
+    }
+}
+
+//--- Главный цикл. Выходит, когда *stop станет ненулевым (например, из обработчика SIGINT).
+static inline int fifo_server_run(struct fifo_server *srv, volatile sig_atomic_t *stop) {
+    struct epoll_event events[FIFO_SERVER_EVENTS];
+    int i, n;
+
+    while ( !*stop ) {
+        if ( (n = epoll_wait(srv->epfd, events, FIFO_SERVER_EVENTS, -1)) == -1 ) {
+            if ( errno == EINTR )
+                continue;
+            perror("epoll_wait");
+            return -1;
+        }
+        for ( i = 0; i < n; i++ )
+            fifo_server_drain(srv, (struct fifo_conn *)events[i].data.ptr);
+    }
+    return 0;
+}
+
+//--- Закрывает и удаляет каналы
+static inline void fifo_server_close(struct fifo_server *srv) {
+    int i;
+
+    for ( i = 0; i < srv->count; i++ ) {
+        close(srv->conns[i].fd);
+        close(srv->conns[i].wfd);
+        remove(srv->conns[i].path);
+    }
+    if ( srv->epfd != -1 )
+        close(srv->epfd);
+    free(srv->conns);
+}
+
+#endif
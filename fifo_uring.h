@@ -0,0 +1,233 @@
+#ifndef FIFO_URING_H
+#define FIFO_URING_H
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "fifo_server.h"
+
+//--- Движок io_uring для сервера каналов (fifo_server.h) без liburing, на "сырых" системных вызовах.
+//--- Каналы регистрируются как fixed files, буферы приема - как registered buffers,
+//--- на каждом канале всегда висит один READ_FIXED. Все повторные чтения после пачки
+//--- завершений отправляются одним io_uring_enter(). С SQPOLL отправку делает поток ядра.
+
+#define FIFO_URING_SQ_IDLE_MS 1000
+
+struct fifo_uring {
+    int                  fd;
+    unsigned             flags;
+    unsigned            *sq_head, *sq_tail, *sq_mask, *sq_flags, *sq_array;
+    unsigned            *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void                *sq_ptr, *cq_ptr;
+    size_t               sq_size, cq_size, sqes_size;
+    unsigned             to_submit;
+};
+
+static inline int io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return syscall(SYS_io_uring_setup, entries, p);
+}
+
+static inline int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return syscall(SYS_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static inline int io_uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args) {
+    return syscall(SYS_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static inline void fifo_uring_close(struct fifo_uring *u) {
+    if ( u->sqes && u->sqes != MAP_FAILED )
+        munmap(u->sqes, u->sqes_size);
+    if ( u->cq_ptr && u->cq_ptr != MAP_FAILED && u->cq_ptr != u->sq_ptr )
+        munmap(u->cq_ptr, u->cq_size);
+    if ( u->sq_ptr && u->sq_ptr != MAP_FAILED )
+        munmap(u->sq_ptr, u->sq_size);
+    if ( u->fd != -1 )
+        close(u->fd);
+}
+
+//--- Создает кольца. Возвращает -1 (errno = ENOSYS, EPERM, ...), если io_uring недоступен.
+static inline int fifo_uring_init(struct fifo_uring *u, unsigned entries, int sqpoll) {
+    struct io_uring_params p;
+    char *sq, *cq;
+
+    memset(u, 0, sizeof(*u));
+    memset(&p, 0, sizeof(p));
+    if ( sqpoll ) {
+        p.flags = IORING_SETUP_SQPOLL;
+        p.sq_thread_idle = FIFO_URING_SQ_IDLE_MS;
+    }
+    if ( (u->fd = io_uring_setup(entries, &p)) == -1 )
+        return -1;
+    u->flags = p.flags;
+
+    u->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if ( p.features & IORING_FEAT_SINGLE_MMAP ) {
+        if ( u->cq_size > u->sq_size )
+            u->sq_size = u->cq_size;
+        u->cq_size = u->sq_size;
+    }
+    u->sq_ptr = mmap(0, u->sq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if ( u->sq_ptr == MAP_FAILED )
+        goto fail;
+    if ( p.features & IORING_FEAT_SINGLE_MMAP )
+        u->cq_ptr = u->sq_ptr;
+    else if ( (u->cq_ptr = mmap(0, u->cq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_CQ_RING)) == MAP_FAILED )
+        goto fail;
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = (struct io_uring_sqe *)mmap(0, u->sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if ( u->sqes == MAP_FAILED )
+        goto fail;
+
+    sq = (char *)u->sq_ptr;
+    cq = (char *)u->cq_ptr;
+    u->sq_head  = (unsigned *)(sq + p.sq_off.head);
+    u->sq_tail  = (unsigned *)(sq + p.sq_off.tail);
+    u->sq_mask  = (unsigned *)(sq + p.sq_off.ring_mask);
+    u->sq_flags = (unsigned *)(sq + p.sq_off.flags);
+    u->sq_array = (unsigned *)(sq + p.sq_off.array);
+    u->cq_head  = (unsigned *)(cq + p.cq_off.head);
+    u->cq_tail  = (unsigned *)(cq + p.cq_off.tail);
+    u->cq_mask  = (unsigned *)(cq + p.cq_off.ring_mask);
+    u->cqes     = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+
+fail:
+    perror("mmap");
+    fifo_uring_close(u);
+    return -1;
+}
+
+//--- Ставит в очередь отправки чтение из канала номер i в его зарегистрированный буфер.
+//--- Сама отправка откладывается до fifo_uring_submit_and_wait().
+static inline void fifo_uring_queue_read(struct fifo_uring *u, struct fifo_server *srv, int i) {
+    struct fifo_frame_reader *r = &srv->conns[i].reader;
+    unsigned tail = *u->sq_tail;
+    unsigned idx = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = i;                         // индекс в таблице зарегистрированных файлов
+    sqe->addr = (unsigned long)(r->buf + r->end);
+    sqe->len = sizeof(r->buf) - r->end;
+    sqe->off = (__u64)-1;                // текущая позиция: для канала смещения нет
+    sqe->buf_index = i;                  // индекс зарегистрированного буфера
+    sqe->user_data = i;
+    u->sq_array[idx] = idx;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    u->to_submit++;
+}
+
+//--- Отправляет все накопленные запросы и ждет хотя бы одного завершения
+static inline int fifo_uring_submit_and_wait(struct fifo_uring *u) {
+    unsigned flags = IORING_ENTER_GETEVENTS;
+    unsigned to_submit = u->to_submit;
+
+    if ( u->flags & IORING_SETUP_SQPOLL ) {
+        //--- запросы забирает поток ядра; будим его, только если он уснул
+        to_submit = 0;
+        if ( __atomic_load_n(u->sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_NEED_WAKEUP )
+            flags |= IORING_ENTER_SQ_WAKEUP;
+    }
+    if ( io_uring_enter(u->fd, to_submit, 1, flags) == -1 )
+        return -1;
+    u->to_submit = 0;
+    return 0;
+}
+
+//--- Главный цикл сервера на io_uring. Каналы уже открыты fifo_server_open().
+//--- Возвращает 0 по *stop, 1 при ошибке или -1, не тронув каналы, если io_uring
+//--- недоступен - тогда можно вызвать fifo_server_run() (epoll).
+static inline int fifo_uring_run(struct fifo_server *srv, volatile sig_atomic_t *stop, int sqpoll) {
+    struct fifo_uring u;
+    struct io_uring_cqe *cqe;
+    struct fifo_conn *c;
+    struct iovec *iov;
+    int *fds;
+    unsigned head, tail, entries = 1;
+    int i, rc = 1;
+
+    while ( entries < (unsigned)srv->count )
+        entries <<= 1;
+    if ( fifo_uring_init(&u, entries, sqpoll) == -1 )
+        return -1;
+
+    iov = (struct iovec *)calloc(srv->count, sizeof(struct iovec));
+    fds = (int *)calloc(srv->count, sizeof(int));
+    if ( iov == NULL || fds == NULL ) {
+        perror("calloc");
+        fifo_uring_close(&u);
+        free(iov);
+        free(fds);
+        return -1;
+    }
+    for ( i = 0; i < srv->count; i++ ) {
+        iov[i].iov_base = srv->conns[i].reader.buf;
+        iov[i].iov_len = sizeof(srv->conns[i].reader.buf);
+        fds[i] = srv->conns[i].fd;
+    }
+    //--- буферы закрепляются в памяти один раз, а не на каждое чтение;
+    //--- для fixed files ядро не ищет дескриптор в таблице процесса на каждый запрос
+    if ( io_uring_register(u.fd, IORING_REGISTER_BUFFERS, iov, srv->count) == -1 ||
+         io_uring_register(u.fd, IORING_REGISTER_FILES, fds, srv->count) == -1 ) {
+        fifo_uring_close(&u);
+        free(iov);
+        free(fds);
+        return -1;
+    }
+
+    //--- O_NONBLOCK нужен только epoll; io_uring сам дождется данных в канале
+    for ( i = 0; i < srv->count; i++ ) {
+        fcntl(srv->conns[i].fd, F_SETFL, fcntl(srv->conns[i].fd, F_GETFL) & ~O_NONBLOCK);
+        fifo_uring_queue_read(&u, srv, i);
+    }
+
+    while ( !*stop ) {
+        if ( fifo_uring_submit_and_wait(&u) == -1 ) {
+            if ( errno == EINTR )
+                continue;
+            perror("io_uring_enter");
+            goto out;
+        }
+
+        head = *u.cq_head;
+        tail = __atomic_load_n(u.cq_tail, __ATOMIC_ACQUIRE);
+        for ( ; head != tail; head++ ) {
+            cqe = &u.cqes[head & *u.cq_mask];
+            c = &srv->conns[cqe->user_data];
+            if ( cqe->res > 0 ) {
+                c->bytes += cqe->res;
+                if ( fifo_frame_received(&c->reader, cqe->res, srv->cb, srv->arg) == -1 ) {
+                    fprintf(stderr, "%s: bad frame, dropping buffered data\n", c->path);
+                    fifo_frame_reader_init(&c->reader);
+                }
+            } else if ( cqe->res < 0 && cqe->res != -EINTR && cqe->res != -EAGAIN ) {
+                fprintf(stderr, "%s: %s\n", c->path, strerror(-cqe->res));
+                continue; // канал больше не читаем
+            }
+            fifo_uring_queue_read(&u, srv, (int)cqe->user_data);
+        }
+        __atomic_store_n(u.cq_head, head, __ATOMIC_RELEASE);
+    }
+    rc = 0;
+
+out:
+    fifo_uring_close(&u);
+    free(iov);
+    free(fds);
+    return rc;
+}
+
+#endif
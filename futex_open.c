@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shm_segment.h"
+#include "futex_wait.h"
+
+#define FUTEX_EVENT_NAME "/my_futex_event"
+
+//--- Так выглядит разделяемая память: событие и флаг, который оно охраняет
+struct futex_shared {
+    struct shm_event event;
+    uint32_t         dropped;
+};
+
+static int is_dropped(void *arg) {
+    return __atomic_load_n(&((struct futex_shared *)arg)->dropped, __ATOMIC_ACQUIRE) != 0;
+}
+
+int main(int argc, char ** argv) {
+    struct futex_shared *shared;
+    size_t size = sizeof(struct futex_shared);
+    uint32_t seq;
+    struct shm_poll poll;
+    int polling = 0;
+
+    //--- ./futex_open poll spin_us [backoff_us] - ожидание в режиме опроса
+    if ( argc >= 3 && !strcmp(argv[1], "poll") ) {
+        shm_poll_init(&poll, strtoull(argv[2], NULL, 0) * 1000,
+                      argc >= 4 ? strtoull(argv[3], NULL, 0) * 1000 : SHM_POLL_BACKOFF_NS);
+        polling = 1;
+    } else if ( argc == 2 ) {
+        printf("Dropping futex event...\n");
+        if ( (shared = (struct futex_shared *)shm_segment_open(FUTEX_EVENT_NAME, &size, 0)) == NULL )
+            return 1;
+        __atomic_store_n(&shared->dropped, 1, __ATOMIC_RELEASE);
+        shm_event_notify(&shared->event); // FUTEX_WAKE только если кто-то спит
+        printf("Futex event dropped.\n");
+        shm_segment_close(shared, size);
+        return 0;
+    }
+
+    if ( (shared = (struct futex_shared *)shm_segment_open(FUTEX_EVENT_NAME, &size, 1)) == NULL )
+        return 1;
+    shm_event_init(&shared->event);
+    shared->dropped = 0;
+
+    printf("Futex event is taken.\nWaiting for it to be dropped.\n");
+    if ( polling && !shm_poll_wait(&poll, is_dropped, shared) )
+        shm_poll_parked(&poll);
+    for ( ;; ) {
+        //--- короткое ожидание в цикле без системных вызовов (в режиме опроса оно уже было)
+        for ( int spin = 0; !polling && spin < SHM_EVENT_SPIN; spin++ ) {
+            if ( __atomic_load_n(&shared->dropped, __ATOMIC_ACQUIRE) )
+                break;
+            cpu_relax();
+        }
+        //--- регистрируемся, проверяем еще раз и только потом засыпаем
+        seq = shm_event_prepare_wait(&shared->event);
+        if ( __atomic_load_n(&shared->dropped, __ATOMIC_ACQUIRE) ) {
+            shm_event_cancel_wait(&shared->event);
+            break;
+        }
+        shm_event_wait(&shared->event, seq);
+    }
+    printf("Futex event dropped by another process.\n");
+    if ( polling )
+        shm_poll_report(&poll, "Futex event");
+
+    shm_segment_close(shared, size);
+    shm_unlink(FUTEX_EVENT_NAME);
+    return 0;
+}
+
+/*
+Futex вместо именованного семафора
+
+В sem_open.c каждое событие - это пара sem_post()/sem_wait() на именованном sem_t.
+Здесь то же самое сделано на "сыром" futex(2): 32-битное слово лежит прямо
+в разделяемой памяти, а ядро вызывается только тогда, когда действительно нужно спать
+или будить.
+
+    FUTEX_WAIT(addr, val) - заснуть, если *addr все еще равен val (проверка атомарна в ядре);
+    FUTEX_WAKE(addr, n)   - разбудить до n процессов, спящих на addr.
+
+Флаг FUTEX_PRIVATE_FLAG не используется, так как слово разделяют разные процессы.
+
+Протокол (futex_wait.h):
+
+    ожидающий: waiters++ -> проверка условия -> FUTEX_WAIT(seq) -> waiters--
+    уведомляющий: публикация условия -> если waiters != 0, то seq++ и FUTEX_WAKE
+
+Если ожидающего нет, уведомление стоит одного барьера и чтения waiters,
+без системного вызова. Перед сном ожидающий недолго крутится (SHM_EVENT_SPIN),
+что убирает засыпание при коротких паузах.
+
+С ключом poll ожидающий вместо SHM_EVENT_SPIN итераций крутится spin_us микросекунд,
+затем еще backoff_us (по умолчанию 500) проверяет флаг с растущими паузами
+и только потом засыпает на futex (shm_poll_wait, см. futex_wait.h). В конце печатается,
+на какой ступени дождались события.
+
+Компилируем:
+
+$ g++ -o futex_open futex_open.c -pthread -lrt
+
+В одной консоли запускаем:
+
+$ ./futex_open
+Futex event is taken.
+Waiting for it to be dropped.       <-- здесь процесс спит на futex
+Futex event dropped by another process.
+
+В соседней консоли запускаем:
+
+$ ./futex_open 1
+Dropping futex event...
+Futex event dropped.
+
+Ожидание в режиме опроса (1 мс крутимся, 10 мс - с паузами):
+
+$ ./futex_open poll 1000 10000
+Futex event is taken.
+Waiting for it to be dropped.
+Futex event dropped by another process.
+Futex event waits: 0 ready, 0 spin, 0 backoff, 1 park (100.0% reached the kernel)
+*/
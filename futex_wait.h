@@ -0,0 +1,145 @@
+#ifndef FUTEX_WAIT_H
+#define FUTEX_WAIT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "ipc_common.h"
+
+//--- Ожидание/пробуждение на futex-словах, лежащих в разделяемой памяти.
+//--- Флаг FUTEX_PRIVATE_FLAG не ставим: слово видят разные процессы.
+
+#define SHM_EVENT_SPIN 1000 // сколько раз проверяем условие перед сном
+
+//--- Режим опроса для потребителей, которым не жалко отдельного ядра: сначала spin_ns
+//--- проверяем условие на каждом шаге, затем еще backoff_ns - с паузами, растущими
+//--- вдвое до SHM_POLL_PAUSE_MAX, и только потом засыпаем в ядре.
+#define SHM_POLL_SPIN_NS    50000  // по умолчанию 50 мкс
+#define SHM_POLL_BACKOFF_NS 500000 // и еще 0,5 мс
+#define SHM_POLL_PAUSE_MAX  1024   // cpu_relax() между проверками на последней ступени
+
+//--- Ступени ожидания: на какой из них условие стало истинным
+#define SHM_POLL_READY   0 // сразу, ждать не пришлось
+#define SHM_POLL_SPIN    1
+#define SHM_POLL_BACKOFF 2
+#define SHM_POLL_PARK    3 // пришлось спать в ядре
+#define SHM_POLL_TIERS   4
+
+static inline long futex(uint32_t *uaddr, int op, uint32_t val, const struct timespec *timeout) {
+    return syscall(SYS_futex, uaddr, op, val, timeout, NULL, 0);
+}
+
+//--- Событие: seq меняется при каждом пробуждении, waiters - число спящих на seq.
+//--- Пока waiters == 0, уведомление обходится без системного вызова.
+struct shm_event {
+    uint32_t seq;
+    uint32_t waiters;
+};
+
+static inline void shm_event_init(struct shm_event *ev) {
+    ev->seq = 0;
+    ev->waiters = 0;
+}
+
+//--- Ожидающий регистрируется ДО последней проверки условия и получает значение seq,
+//--- на котором потом будет спать. Если условие уже выполнено - shm_event_cancel_wait().
+static inline uint32_t shm_event_prepare_wait(struct shm_event *ev) {
+    __atomic_fetch_add(&ev->waiters, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return __atomic_load_n(&ev->seq, __ATOMIC_SEQ_CST);
+}
+
+static inline void shm_event_cancel_wait(struct shm_event *ev) {
+    __atomic_fetch_sub(&ev->waiters, 1, __ATOMIC_RELAXED);
+}
+
+//--- Спит, пока seq равен значению, полученному в shm_event_prepare_wait().
+//--- Снимает регистрацию ожидающего перед выходом.
+static inline void shm_event_wait(struct shm_event *ev, uint32_t seq) {
+    while ( __atomic_load_n(&ev->seq, __ATOMIC_ACQUIRE) == seq ) {
+        if ( futex(&ev->seq, FUTEX_WAIT, seq, NULL) == -1 && errno != EAGAIN && errno != EINTR )
+            break;
+    }
+    shm_event_cancel_wait(ev);
+}
+
+//--- Вызывается после того, как условие стало истинным (данные опубликованы).
+//--- Барьер упорядочивает публикацию данных и чтение waiters: либо ожидающий
+//--- увидит новые данные при последней проверке, либо мы увидим его в waiters.
+static inline void shm_event_notify(struct shm_event *ev) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if ( __atomic_load_n(&ev->waiters, __ATOMIC_RELAXED) == 0 )
+        return;
+    __atomic_fetch_add(&ev->seq, 1, __ATOMIC_SEQ_CST);
+    futex(&ev->seq, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+struct shm_poll {
+    uint64_t spin_ns;
+    uint64_t backoff_ns;
+    uint64_t tiers[SHM_POLL_TIERS]; // сколько ожиданий закончилось на каждой ступени
+};
+
+static inline void shm_poll_init(struct shm_poll *p, uint64_t spin_ns, uint64_t backoff_ns) {
+    p->spin_ns = spin_ns;
+    p->backoff_ns = backoff_ns;
+    memset(p->tiers, 0, sizeof(p->tiers));
+}
+
+//--- Ступени без ядра. ready(arg) проверяет условие (и может сразу забрать данные).
+//--- Возвращает 1, если дождались, 0 - бюджет исчерпан, вызывающий засыпает
+//--- своим способом и отмечает это shm_poll_parked().
+static inline int shm_poll_wait(struct shm_poll *p, int (*ready)(void *), void *arg) {
+    uint64_t start, deadline;
+    uint32_t i, pause;
+
+    if ( ready(arg) ) {
+        p->tiers[SHM_POLL_READY]++;
+        return 1;
+    }
+    //--- часы читаем не на каждом шаге: clock_gettime() дороже проверки условия
+    start = now_ns();
+    deadline = start + p->spin_ns;
+    for ( i = 1; ; i++ ) {
+        if ( ready(arg) ) {
+            p->tiers[SHM_POLL_SPIN]++;
+            return 1;
+        }
+        cpu_relax();
+        if ( !(i & 63) && now_ns() >= deadline )
+            break;
+    }
+    deadline += p->backoff_ns;
+    for ( pause = 2; now_ns() < deadline; pause = pause < SHM_POLL_PAUSE_MAX ? pause * 2 : pause ) {
+        for ( i = 0; i < pause; i++ )
+            cpu_relax();
+        if ( ready(arg) ) {
+            p->tiers[SHM_POLL_BACKOFF]++;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static inline void shm_poll_parked(struct shm_poll *p) {
+    p->tiers[SHM_POLL_PARK]++;
+}
+
+static inline void shm_poll_report(const struct shm_poll *p, const char *who) {
+    uint64_t total = 0;
+    int i;
+
+    for ( i = 0; i < SHM_POLL_TIERS; i++ )
+        total += p->tiers[i];
+    printf("%s waits: %llu ready, %llu spin, %llu backoff, %llu park (%.1f%% reached the kernel)\n", who,
+           (unsigned long long)p->tiers[SHM_POLL_READY], (unsigned long long)p->tiers[SHM_POLL_SPIN],
+           (unsigned long long)p->tiers[SHM_POLL_BACKOFF], (unsigned long long)p->tiers[SHM_POLL_PARK],
+           total ? p->tiers[SHM_POLL_PARK] * 100.0 / total : 0.0);
+}
+
+#endif
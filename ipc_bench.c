@@ -0,0 +1,548 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <semaphore.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "ipc_common.h"
+#include "shm_segment.h"
+#include "futex_wait.h"
+#include "latency_hist.h"
+#include "cpu_affinity.h"
+
+#define BENCH_SHM_NAME  "ipc_bench"
+#define BENCH_FIFO_AB   "/tmp/ipc_bench_ab"
+#define BENCH_FIFO_BA   "/tmp/ipc_bench_ba"
+#define BENCH_SEM_NAME  "/ipc_bench_%s%d"
+#define MIN_SIZE        8
+#define MAX_SIZE        (1024 * 1024)
+#define DEFAULT_ITERS   10000
+#define BYTES_BUDGET    (256L * 1024 * 1024) // больше этого за один прогон не гоняем
+#define MIN_ITERS       100
+
+#define MECH_PIPE      0
+#define MECH_FIFO      1
+#define MECH_UNIX      2
+#define MECH_EVENTFD   3
+#define MECH_SHM_SEM   4
+#define MECH_SHM_FUTEX 5
+#define MECH_SHM_SPIN  6
+#define MECH_KINDS     7
+
+static const char *mech_names[MECH_KINDS] = {
+    "pipe", "fifo", "unix", "eventfd", "shm_sem", "shm_futex", "shm_spin"
+};
+
+//--- Почтовый ящик в разделяемой памяти: одно сообщение за раз.
+//--- full = 1 - сообщение лежит и ждет получателя, 0 - ящик свободен.
+struct mailbox {
+    uint32_t         full;
+    struct shm_event changed CACHE_ALIGNED; // shm_futex: ждем смены full
+    uint32_t         len CACHE_ALIGNED;
+    char             data[] CACHE_ALIGNED;
+};
+
+//--- Одно направление канала. Для fd-механизмов данные идут через rfd/wfd,
+//--- для остальных - через ящик, а уведомление - семафорами или eventfd.
+struct link {
+    int             rfd, wfd;            // pipe, fifo, unix
+    struct mailbox *box;                 // eventfd, shm_*
+    sem_t          *sem_full, *sem_empty; // shm_sem
+    int             efd_full, efd_empty;  // eventfd
+};
+
+static int mech;
+static struct cpu_affinity affinity;
+static int peer_cpu = -1; // куда привязать потомка-эхо
+
+static size_t mailbox_size(void) {
+    return (sizeof(struct mailbox) + MAX_SIZE + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+    ssize_t n;
+
+    while ( len ) {
+        if ( (n = write(fd, buf, len)) == -1 ) {
+            if ( errno == EINTR )
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int read_all(int fd, char *buf, size_t len) {
+    ssize_t n;
+
+    while ( len ) {
+        if ( (n = read(fd, buf, len)) <= 0 ) {
+            if ( n == -1 && errno == EINTR )
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void efd_wait(int fd) {
+    uint64_t v;
+
+    while ( read(fd, &v, sizeof(v)) == -1 && errno == EINTR )
+        ;
+}
+
+static void efd_post(int fd) {
+    uint64_t v = 1;
+
+    while ( write(fd, &v, sizeof(v)) == -1 && errno == EINTR )
+        ;
+}
+
+//--- Ждет, пока full станет равен state. shm_spin только крутится (уступая процессор,
+//--- если на нем больше никто не работает), shm_futex сразу засыпает на futex,
+//--- чтобы мерить именно путь пробуждения через ядро.
+static void box_wait(struct mailbox *box, uint32_t state) {
+    int spin = SHM_EVENT_SPIN;
+    uint32_t seq;
+
+    while ( __atomic_load_n(&box->full, __ATOMIC_ACQUIRE) != state ) {
+        if ( mech == MECH_SHM_SPIN ) {
+            if ( spin-- > 0 ) {
+                cpu_relax();
+            } else {
+                sched_yield();
+                spin = SHM_EVENT_SPIN;
+            }
+            continue;
+        }
+        seq = shm_event_prepare_wait(&box->changed);
+        if ( __atomic_load_n(&box->full, __ATOMIC_ACQUIRE) == state ) {
+            shm_event_cancel_wait(&box->changed);
+            break;
+        }
+        shm_event_wait(&box->changed, seq);
+    }
+}
+
+static void box_set(struct mailbox *box, uint32_t state) {
+    __atomic_store_n(&box->full, state, __ATOMIC_RELEASE);
+    if ( mech == MECH_SHM_FUTEX )
+        shm_event_notify(&box->changed);
+}
+
+static void link_send(struct link *l, const char *buf, uint32_t len) {
+    switch ( mech ) {
+    case MECH_PIPE:
+    case MECH_FIFO:
+    case MECH_UNIX:
+        if ( write_all(l->wfd, buf, len) == -1 ) {
+            perror("write");
+            exit(1);
+        }
+        return;
+    case MECH_EVENTFD:   efd_wait(l->efd_empty); break;
+    case MECH_SHM_SEM:   sem_wait(l->sem_empty); break;
+    default:             box_wait(l->box, 0); break;
+    }
+    l->box->len = len;
+    memcpy(l->box->data, buf, len);
+    switch ( mech ) {
+    case MECH_EVENTFD:   efd_post(l->efd_full); break;
+    case MECH_SHM_SEM:   sem_post(l->sem_full); break;
+    default:             box_set(l->box, 1); break;
+    }
+}
+
+static void link_recv(struct link *l, char *buf, uint32_t len) {
+    switch ( mech ) {
+    case MECH_PIPE:
+    case MECH_FIFO:
+    case MECH_UNIX:
+        if ( read_all(l->rfd, buf, len) == -1 ) {
+            perror("read");
+            exit(1);
+        }
+        return;
+    case MECH_EVENTFD:   efd_wait(l->efd_full); break;
+    case MECH_SHM_SEM:   sem_wait(l->sem_full); break;
+    default:             box_wait(l->box, 1); break;
+    }
+    memcpy(buf, l->box->data, l->box->len);
+    switch ( mech ) {
+    case MECH_EVENTFD:   efd_post(l->efd_empty); break;
+    case MECH_SHM_SEM:   sem_post(l->sem_empty); break;
+    default:             box_set(l->box, 0); break;
+    }
+}
+
+static sem_t *bench_sem(const char *what, int dir, unsigned value) {
+    char name[64];
+    sem_t *sem;
+
+    snprintf(name, sizeof(name), BENCH_SEM_NAME, what, dir);
+    sem_unlink(name);
+    if ( (sem = sem_open(name, O_CREAT|O_EXCL, 0600, value)) == SEM_FAILED ) {
+        perror("sem_open");
+        return NULL;
+    }
+    sem_unlink(name); // семафор живет, пока его держат открытым наши процессы
+    return sem;
+}
+
+//--- Ресурсы, которые надо создать до fork(): оба процесса наследуют их.
+//--- l[0] - направление от родителя к потомку, l[1] - обратно.
+static int link_setup(struct link *l, void **seg, size_t *seg_size) {
+    int fds[2], d;
+
+    memset(l, 0, 2 * sizeof(*l));
+    *seg = NULL;
+    switch ( mech ) {
+    case MECH_PIPE:
+        for ( d = 0; d < 2; d++ ) {
+            if ( pipe(fds) == -1 ) {
+                perror("pipe");
+                return -1;
+            }
+            l[d].rfd = fds[0];
+            l[d].wfd = fds[1];
+        }
+        return 0;
+    case MECH_FIFO:
+        //--- открывать FIFO будем после fork(): open() ждет вторую сторону
+        unlink(BENCH_FIFO_AB);
+        unlink(BENCH_FIFO_BA);
+        if ( mkfifo(BENCH_FIFO_AB, 0600) == -1 || mkfifo(BENCH_FIFO_BA, 0600) == -1 ) {
+            perror("mkfifo");
+            return -1;
+        }
+        return 0;
+    case MECH_UNIX:
+        if ( socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1 ) {
+            perror("socketpair");
+            return -1;
+        }
+        l[0].wfd = l[1].rfd = fds[0];
+        l[0].rfd = l[1].wfd = fds[1];
+        return 0;
+    }
+
+    //--- остальным нужны ящики в общем сегменте, по одному на направление
+    *seg_size = 2 * mailbox_size();
+    if ( (*seg = shm_segment_map(BENCH_SHM_NAME, seg_size, 1, SHM_SEG_POPULATE)) == NULL )
+        return -1;
+    shm_unlink(BENCH_SHM_NAME); // отображение переживет fork(), имя больше не нужно
+    for ( d = 0; d < 2; d++ ) {
+        l[d].box = (struct mailbox *)((char *)*seg + d * mailbox_size());
+        memset(l[d].box, 0, sizeof(struct mailbox));
+        shm_event_init(&l[d].box->changed);
+        if ( mech == MECH_SHM_SEM ) {
+            if ( (l[d].sem_full = bench_sem("full", d, 0)) == NULL ||
+                 (l[d].sem_empty = bench_sem("empty", d, 1)) == NULL )
+                return -1;
+        } else if ( mech == MECH_EVENTFD ) {
+            if ( (l[d].efd_full = eventfd(0, 0)) == -1 || (l[d].efd_empty = eventfd(1, 0)) == -1 ) {
+                perror("eventfd");
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static int fifo_open_side(struct link *l, int parent) {
+    //--- порядок open() одинаков у обеих сторон, иначе они ждали бы друг друга вечно
+    if ( parent ) {
+        l[0].wfd = open(BENCH_FIFO_AB, O_WRONLY);
+        l[1].rfd = open(BENCH_FIFO_BA, O_RDONLY);
+    } else {
+        l[0].rfd = open(BENCH_FIFO_AB, O_RDONLY);
+        l[1].wfd = open(BENCH_FIFO_BA, O_WRONLY);
+    }
+    if ( (parent ? l[0].wfd : l[0].rfd) == -1 || (parent ? l[1].rfd : l[1].wfd) == -1 ) {
+        perror("open");
+        return -1;
+    }
+    return 0;
+}
+
+static void link_teardown(struct link *l, void *seg, size_t seg_size) {
+    int d;
+
+    for ( d = 0; d < 2; d++ ) {
+        if ( l[d].rfd > 0 )
+            close(l[d].rfd);
+        if ( l[d].wfd > 0 && mech != MECH_UNIX )
+            close(l[d].wfd);
+        if ( l[d].efd_full > 0 )
+            close(l[d].efd_full);
+        if ( l[d].efd_empty > 0 )
+            close(l[d].efd_empty);
+        if ( l[d].sem_full )
+            sem_close(l[d].sem_full);
+        if ( l[d].sem_empty )
+            sem_close(l[d].sem_empty);
+    }
+    if ( seg )
+        shm_segment_close(seg, seg_size);
+    if ( mech == MECH_FIFO ) {
+        unlink(BENCH_FIFO_AB);
+        unlink(BENCH_FIFO_BA);
+    }
+}
+
+//--- Сколько сообщений размера size гонять: iters, но не больше BYTES_BUDGET байт
+static long bench_iters(long iters, uint32_t size) {
+    long n = BYTES_BUDGET / size;
+
+    if ( n < MIN_ITERS )
+        n = MIN_ITERS;
+    return n < iters ? n : iters;
+}
+
+//--- Следующий размер сообщения: шаг x8, последний - ровно max_size; 0 - размеры кончились
+static uint32_t next_size(uint32_t size, uint32_t max_size) {
+    if ( size >= max_size )
+        return 0;
+    return size * 8 < max_size ? size * 8 : max_size;
+}
+
+//--- Потомок: эхо для ping-pong и приемник для потока, те же размеры и число
+//--- сообщений, что и у родителя. В конце потока отвечает одним байтом.
+static void peer(struct link *rx, struct link *tx, char *buf, long iters, uint32_t max_size) {
+    uint32_t size;
+    long i, n, warmup;
+
+    for ( size = MIN_SIZE; size; size = next_size(size, max_size) ) {
+        n = bench_iters(iters, size);
+        warmup = n / 10;
+        for ( i = 0; i < warmup + n; i++ ) {
+            link_recv(rx, buf, size);
+            link_send(tx, buf, size);
+        }
+        for ( i = 0; i < n; i++ )
+            link_recv(rx, buf, size);
+        link_send(tx, buf, 1);
+    }
+}
+
+static void report(const char *test, uint32_t size, long n, uint64_t ns, const struct lat_hist *h) {
+    printf("%s,%s,%u,%ld,%.0f,%.1f,%.0f,%llu,%llu,%llu,%llu,%llu\n", mech_names[mech], test, size, n,
+           n * 1e9 / ns, (double)n * size * 1e9 / ns / (1024 * 1024), lat_hist_mean(h),
+           (unsigned long long)lat_hist_percentile(h, 0.50),
+           (unsigned long long)lat_hist_percentile(h, 0.90),
+           (unsigned long long)lat_hist_percentile(h, 0.99),
+           (unsigned long long)lat_hist_percentile(h, 0.999),
+           (unsigned long long)h->max);
+    fflush(stdout);
+}
+
+//--- Родитель: ping-pong (время полного оборота) и поток (время каждого вызова отправки,
+//--- т.е. сколько писатель ждал места в канале), затем следующий размер
+static void run(struct link *tx, struct link *rx, char *buf, long iters, uint32_t max_size) {
+    struct lat_hist hist;
+    uint32_t size;
+    long i, n, warmup;
+    uint64_t t0, t1, start = 0;
+
+    for ( size = MIN_SIZE; size; size = next_size(size, max_size) ) {
+        n = bench_iters(iters, size);
+        warmup = n / 10;
+        lat_hist_init(&hist);
+        for ( i = 0; i < warmup + n; i++ ) {
+            if ( i == warmup )
+                start = now_ns();
+            t0 = now_ns();
+            link_send(tx, buf, size);
+            link_recv(rx, buf, size);
+            t1 = now_ns();
+            if ( i >= warmup )
+                lat_hist_record(&hist, t1 - t0);
+        }
+        report("pingpong", size, n, now_ns() - start, &hist);
+
+        lat_hist_init(&hist);
+        start = now_ns();
+        for ( i = 0; i < n; i++ ) {
+            t0 = now_ns();
+            link_send(tx, buf, size);
+            lat_hist_record(&hist, now_ns() - t0);
+        }
+        link_recv(rx, buf, 1);
+        report("stream", size, n, now_ns() - start, &hist);
+    }
+}
+
+//--- Один механизм: создает канал, запускает потомка-эхо и прогоняет все размеры
+static int bench_mech(long iters, uint32_t max_size, char *buf) {
+    struct link l[2];
+    void *seg;
+    size_t seg_size = 0;
+    pid_t pid;
+    int status, parent;
+
+    if ( link_setup(l, &seg, &seg_size) == -1 ) {
+        link_teardown(l, seg, seg_size);
+        return -1;
+    }
+    fflush(stdout);
+    if ( (pid = fork()) == -1 ) {
+        perror("fork");
+        link_teardown(l, seg, seg_size);
+        return -1;
+    }
+    parent = pid != 0;
+    if ( mech == MECH_FIFO && fifo_open_side(l, parent) == -1 ) {
+        if ( !parent )
+            _exit(1);
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        link_teardown(l, seg, seg_size);
+        return -1;
+    }
+
+    if ( !parent ) {
+        cpu_affinity_pin_self(peer_cpu);
+        peer(&l[0], &l[1], buf, iters, max_size);
+        _exit(0);
+    }
+    run(&l[0], &l[1], buf, iters, max_size);
+    waitpid(pid, &status, 0);
+    link_teardown(l, seg, seg_size);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+static int mech_by_name(const char *name) {
+    int m;
+
+    for ( m = 0; m < MECH_KINDS; m++ )
+        if ( !strcmp(name, mech_names[m]) )
+            return m;
+    return -1;
+}
+
+int main(int argc, char ** argv) {
+    int selected[MECH_KINDS] = { 0 };
+    long iters = DEFAULT_ITERS;
+    uint32_t max_size = MAX_SIZE;
+    char *buf, *tok;
+    int m, bad = 0;
+
+    //--- родитель и потомок - первые два процессора из --cpus/IPC_CPUS
+    if ( cpu_affinity_init(&affinity, &argc, argv) == -1 )
+        return 1;
+    if ( cpu_affinity_pin_self(cpu_affinity_next(&affinity)) == -1 )
+        return 1;
+    peer_cpu = cpu_affinity_next(&affinity);
+
+    if ( argc >= 2 && strcmp(argv[1], "all") ) {
+        for ( tok = strtok(argv[1], ","); tok; tok = strtok(NULL, ",") )
+            if ( (m = mech_by_name(tok)) >= 0 )
+                selected[m] = 1;
+            else
+                bad = 1;
+    } else {
+        for ( m = 0; m < MECH_KINDS; m++ )
+            selected[m] = 1;
+    }
+    if ( argc >= 3 )
+        iters = atol(argv[2]);
+    if ( argc >= 4 )
+        max_size = strtoul(argv[3], NULL, 0);
+    if ( bad || iters < 1 || max_size < MIN_SIZE || max_size > MAX_SIZE || argc > 4 ) {
+        printf("Usage: %s [all|mech,mech,...] [iters] [max_size] [--cpus list|pair|smt|remote]\n", argv[0]);
+        printf("Mechanisms:");
+        for ( m = 0; m < MECH_KINDS; m++ )
+            printf(" %s", mech_names[m]);
+        printf("\n");
+        return 1;
+    }
+
+    //--- буфер сообщений; страницы трогаем заранее, чтобы не мерить page fault
+    if ( (buf = (char *)malloc(MAX_SIZE)) == NULL ) {
+        perror("malloc");
+        return 1;
+    }
+    memset(buf, 'x', MAX_SIZE);
+
+    printf("mech,test,msg_size,msgs,msgs_per_sec,mib_per_sec,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns\n");
+    for ( mech = 0; mech < MECH_KINDS; mech++ )
+        if ( selected[mech] && bench_mech(iters, max_size, buf) == -1 )
+            fprintf(stderr, "%s: benchmark failed\n", mech_names[mech]);
+
+    free(buf);
+    return 0;
+}
+
+/*
+Сравнение механизмов IPC
+
+Уроки mkfifo.c, shm.c, sem_open.c и mutex.c показывают механизмы по отдельности.
+Эта программа гоняет один и тот же обмен через каждый из них между родителем
+и потомком (fork) и печатает CSV, который удобно сравнивать (diff) между ядрами и машинами:
+
+    pipe      - два анонимных канала pipe()
+    fifo      - два именованных канала в /tmp (mkfifo)
+    unix      - пара сокетов UNIX (socketpair, SOCK_STREAM)
+    eventfd   - данные в разделяемой памяти, уведомление через eventfd
+    shm_sem   - данные в разделяемой памяти, уведомление именованными семафорами (sem_open)
+    shm_futex - данные в разделяемой памяти, ожидание на futex (futex_wait.h)
+    shm_spin  - данные в разделяемой памяти, опрос флага в цикле
+
+Для разделяемой памяти в каждую сторону есть "почтовый ящик" на одно сообщение:
+писатель ждет, пока ящик освободится, копирует сообщение и поднимает флаг, читатель
+копирует сообщение к себе и опускает флаг. Т.е. копирований столько же, сколько у
+канала: в общую память и обратно, разница - только в цене уведомления.
+
+Для каждого размера сообщения от 8 байт до max_size (шаг - умножение на 8,
+последний размер - ровно max_size) два теста:
+
+    pingpong - родитель отправляет сообщение, потомок возвращает его целиком;
+               перцентили - время полного оборота
+    stream   - родитель отправляет сообщения подряд, потомок только читает и в конце
+               отвечает одним байтом; перцентили - время одного вызова отправки
+
+Число сообщений - iters, но не больше 256 МБ на прогон (и не меньше 100);
+первые 10% оборотов ping-pong - разогрев, в статистику не попадают.
+Перцентили считает гистограмма latency_hist.h (погрешность около 3%).
+
+Компилируем:
+
+$ g++ -O2 -o ipc_bench ipc_bench.c -pthread -lrt
+
+$ ./ipc_bench > ipc.csv
+$ ./ipc_bench pipe,shm_futex,shm_spin 100000 4096
+mech,test,msg_size,msgs,msgs_per_sec,mib_per_sec,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns
+...
+
+Где работают родитель и потомок, решает планировщик, а от этого результат меняется
+в разы: общий кэш L3 у двух ядер, гиперпотоки одного ядра, разные сокеты.
+Ключ --cpus (или переменная окружения IPC_CPUS) привязывает родителя к первому
+процессору, потомка - ко второму (cpu_affinity.h):
+
+    --cpus 2,6     явно заданные процессоры
+    --cpus pair    два разных ядра с общим кэшем последнего уровня
+    --cpus smt     два гиперпотока одного ядра
+    --cpus remote  разные кэши последнего уровня, по возможности разные сокеты
+
+Топология из /sys/devices/system/cpu и выбранные процессоры печатаются в stderr,
+чтобы не мешать CSV:
+
+$ ./ipc_bench shm_spin 100000 64 --cpus pair > pair.csv
+# topology: 16 CPUs allowed, 1 packages, 8 cores, 1 last-level caches
+# affinity: #0 -> cpu 0 (package 0, core 0, L3 shared from cpu 0)
+# affinity: #1 -> cpu 1 (package 0, core 1, L3 shared from cpu 0)
+$ IPC_CPUS=smt ./ipc_bench shm_spin 100000 64 > smt.csv
+
+shm_spin честно крутится только если у родителя и потомка есть по своему ядру;
+на одном ядре он после SHM_EVENT_SPIN попыток уступает процессор (sched_yield),
+иначе каждый обмен стоил бы кванта планировщика.
+*/
@@ -0,0 +1,30 @@
+#ifndef IPC_COMMON_H
+#define IPC_COMMON_H
+
+#include <stdint.h>
+#include <time.h>
+
+//--- Размер строки кэша. Счетчики, которые пишут разные процессы/потоки,
+//--- разносим по разным строкам, чтобы не было false sharing.
+#define CACHE_LINE_SIZE 64
+#define CACHE_ALIGNED   __attribute__((aligned(CACHE_LINE_SIZE)))
+
+//--- Подсказка процессору, что мы крутимся в цикле ожидания
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield" ::: "memory");
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+//--- Монотонное время в наносекундах
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+#endif
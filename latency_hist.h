@@ -0,0 +1,94 @@
+#ifndef LATENCY_HIST_H
+#define LATENCY_HIST_H
+
+#include <stdint.h>
+#include <string.h>
+
+//--- Гистограмма задержек в стиле HDR: диапазоны степеней двойки, каждый поделен
+//--- на LAT_HIST_HALF равных частей. Относительная погрешность - не хуже 1/LAT_HIST_HALF
+//--- (около 3%) на всем диапазоне от наносекунд до часов, размер фиксирован.
+//--- Запись значения - несколько инструкций, без выделения памяти.
+
+#define LAT_HIST_SUB_BITS 6
+#define LAT_HIST_HALF     (1 << (LAT_HIST_SUB_BITS - 1))
+#define LAT_HIST_BUCKETS  ((64 - LAT_HIST_SUB_BITS + 2) * LAT_HIST_HALF)
+
+struct lat_hist {
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    double   sum;
+    uint64_t counts[LAT_HIST_BUCKETS];
+};
+
+static inline void lat_hist_init(struct lat_hist *h) {
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+//--- Значения меньше 2*LAT_HIST_HALF хранятся точно, остальные - с шагом 2^e
+static inline unsigned lat_hist_index(uint64_t v) {
+    unsigned e;
+
+    if ( v < 2 * LAT_HIST_HALF )
+        return (unsigned)v;
+    e = 63 - __builtin_clzll(v) - (LAT_HIST_SUB_BITS - 1);
+    return e * LAT_HIST_HALF + (unsigned)(v >> e);
+}
+
+//--- Нижняя граница значений, попадающих в ячейку idx
+static inline uint64_t lat_hist_value(unsigned idx) {
+    unsigned e;
+
+    if ( idx < 2 * LAT_HIST_HALF )
+        return idx;
+    e = idx / LAT_HIST_HALF - 1;
+    return (uint64_t)(idx - e * LAT_HIST_HALF) << e;
+}
+
+static inline void lat_hist_record(struct lat_hist *h, uint64_t v) {
+    h->counts[lat_hist_index(v)]++;
+    h->count++;
+    h->sum += v;
+    if ( v < h->min )
+        h->min = v;
+    if ( v > h->max )
+        h->max = v;
+}
+
+static inline void lat_hist_merge(struct lat_hist *dst, const struct lat_hist *src) {
+    unsigned i;
+
+    for ( i = 0; i < LAT_HIST_BUCKETS; i++ )
+        dst->counts[i] += src->counts[i];
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if ( src->min < dst->min )
+        dst->min = src->min;
+    if ( src->max > dst->max )
+        dst->max = src->max;
+}
+
+//--- Значение, не превышаемое долей p (0..1) измерений
+static inline uint64_t lat_hist_percentile(const struct lat_hist *h, double p) {
+    uint64_t rank, seen = 0;
+    unsigned i;
+
+    if ( !h->count )
+        return 0;
+    rank = (uint64_t)(p * h->count);
+    if ( rank >= h->count )
+        rank = h->count - 1;
+    for ( i = 0; i < LAT_HIST_BUCKETS; i++ ) {
+        seen += h->counts[i];
+        if ( seen > rank )
+            return lat_hist_value(i) > h->max ? h->max : lat_hist_value(i);
+    }
+    return h->max;
+}
+
+static inline double lat_hist_mean(const struct lat_hist *h) {
+    return h->count ? h->sum / h->count : 0.0;
+}
+
+#endif
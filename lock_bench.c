@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "ipc_common.h"
+#include "latency_hist.h"
+#include "locks.h"
+
+#define MAX_THREADS     256
+#define MAX_CS_LENS     16
+#define DEFAULT_TIME_MS 500
+#define OUTSIDE_WORK    50 // работа вне критической секции между захватами
+
+#define LOCK_PTHREAD  0
+#define LOCK_TRYLOCK  1
+#define LOCK_TTAS     2
+#define LOCK_TICKET   3
+#define LOCK_MCS      4
+#define LOCK_FUTEX    5
+#define LOCK_KINDS    6
+
+static const char *lock_names[LOCK_KINDS] = {
+    "pthread_mutex", "pthread_trylock", "ttas", "ticket", "mcs", "futex"
+};
+
+//--- Все замки сразу, в каждом прогоне используется один. Каждый в своей строке кэша.
+static struct {
+    pthread_mutex_t    mutex  CACHE_ALIGNED;
+    struct ttas_lock   ttas   CACHE_ALIGNED;
+    struct ticket_lock ticket CACHE_ALIGNED;
+    struct mcs_lock    mcs    CACHE_ALIGNED;
+    struct futex_mutex futex  CACHE_ALIGNED;
+    long               counter CACHE_ALIGNED; // shared resource
+} shared;
+
+struct worker {
+    pthread_t       tid;
+    long            ops;
+    struct mcs_node node;
+    struct lat_hist hist; // время захвата замка, нс
+} CACHE_ALIGNED;
+
+static int kind, cs_len;
+static volatile int stop;
+static pthread_barrier_t start_barrier;
+
+static inline void busy_work(int n) {
+    for ( int i = 0; i < n; i++ )
+        __asm__ __volatile__("" ::: "memory");
+}
+
+static inline void bench_lock(struct worker *w) {
+    switch ( kind ) {
+    case LOCK_PTHREAD: pthread_mutex_lock(&shared.mutex); break;
+    case LOCK_TRYLOCK:
+        while ( pthread_mutex_trylock(&shared.mutex) )
+            cpu_relax();
+        break;
+    case LOCK_TTAS:    ttas_lock(&shared.ttas); break;
+    case LOCK_TICKET:  ticket_lock(&shared.ticket); break;
+    case LOCK_MCS:     mcs_lock(&shared.mcs, &w->node); break;
+    case LOCK_FUTEX:   futex_mutex_lock(&shared.futex); break;
+    }
+}
+
+static inline void bench_unlock(struct worker *w) {
+    switch ( kind ) {
+    case LOCK_PTHREAD:
+    case LOCK_TRYLOCK: pthread_mutex_unlock(&shared.mutex); break;
+    case LOCK_TTAS:    ttas_unlock(&shared.ttas); break;
+    case LOCK_TICKET:  ticket_unlock(&shared.ticket); break;
+    case LOCK_MCS:     mcs_unlock(&shared.mcs, &w->node); break;
+    case LOCK_FUTEX:   futex_mutex_unlock(&shared.futex); break;
+    }
+}
+
+void *incr_counter(void *p) {
+    struct worker *w = (struct worker *)p;
+    uint64_t t0, t1;
+
+    pthread_barrier_wait(&start_barrier);
+    while ( !stop ) {
+        t0 = now_ns();
+        bench_lock(w);
+        t1 = now_ns();
+        shared.counter++;
+        busy_work(cs_len);
+        bench_unlock(w);
+        lat_hist_record(&w->hist, t1 - t0);
+        w->ops++;
+        busy_work(OUTSIDE_WORK);
+    }
+    return NULL;
+}
+
+//--- Один прогон: nthreads потоков, замок kind, критическая секция cs_len
+void run(struct worker *workers, int nthreads, int time_ms) {
+    struct lat_hist total;
+    double sum = 0, sum_sq = 0, fairness;
+    long ops = 0;
+    int i;
+
+    memset(&shared, 0, sizeof(shared));
+    pthread_mutex_init(&shared.mutex, NULL);
+    stop = 0;
+    pthread_barrier_init(&start_barrier, NULL, nthreads + 1);
+    for ( i = 0; i < nthreads; i++ ) {
+        workers[i].ops = 0;
+        lat_hist_init(&workers[i].hist);
+        pthread_create(&workers[i].tid, NULL, incr_counter, &workers[i]);
+    }
+    pthread_barrier_wait(&start_barrier);
+    usleep(time_ms * 1000);
+    stop = 1;
+
+    lat_hist_init(&total);
+    for ( i = 0; i < nthreads; i++ ) {
+        pthread_join(workers[i].tid, NULL);
+        lat_hist_merge(&total, &workers[i].hist);
+        ops += workers[i].ops;
+        sum += workers[i].ops;
+        sum_sq += (double)workers[i].ops * workers[i].ops;
+    }
+    pthread_barrier_destroy(&start_barrier);
+    pthread_mutex_destroy(&shared.mutex);
+
+    if ( shared.counter != ops )
+        fprintf(stderr, "%s: counter %ld != ops %ld, the lock is broken\n", lock_names[kind], shared.counter, ops);
+
+    //--- индекс справедливости Джайна: 1 - все потоки получили поровну, 1/n - все досталось одному
+    fairness = sum_sq > 0 ? sum * sum / (nthreads * sum_sq) : 0;
+    printf("%s,%d,%d,%.0f,%.3f,%llu,%llu,%llu,%llu\n", lock_names[kind], nthreads, cs_len,
+           ops * 1000.0 / time_ms, fairness,
+           (unsigned long long)lat_hist_percentile(&total, 0.50),
+           (unsigned long long)lat_hist_percentile(&total, 0.99),
+           (unsigned long long)lat_hist_percentile(&total, 0.999),
+           (unsigned long long)total.max);
+    fflush(stdout);
+}
+
+int main(int argc, char ** argv) {
+    struct worker *workers;
+    int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int time_ms = DEFAULT_TIME_MS;
+    int cs_lens[MAX_CS_LENS] = { 0, 100, 1000 };
+    int ncs = 3, n, c;
+    char *tok;
+
+    if ( max_threads > MAX_THREADS )
+        max_threads = MAX_THREADS;
+    if ( argc >= 2 )
+        max_threads = atoi(argv[1]);
+    if ( argc >= 3 )
+        time_ms = atoi(argv[2]);
+    if ( argc >= 4 ) {
+        for ( ncs = 0, tok = strtok(argv[3], ","); tok && ncs < MAX_CS_LENS; tok = strtok(NULL, ",") )
+            cs_lens[ncs++] = atoi(tok);
+    }
+    if ( max_threads < 1 || max_threads > MAX_THREADS || time_ms < 1 || argc > 4 ) {
+        printf("Usage: %s [max_threads] [time_ms] [cs_len,cs_len,...]\n", argv[0]);
+        return 1;
+    }
+
+    if ( posix_memalign((void **)&workers, CACHE_LINE_SIZE, max_threads * sizeof(struct worker)) ) {
+        perror("posix_memalign");
+        return 1;
+    }
+
+    printf("lock,threads,cs_len,ops_per_sec,fairness,p50_ns,p99_ns,p999_ns,max_ns\n");
+    for ( kind = 0; kind < LOCK_KINDS; kind++ )
+        for ( c = 0; c < ncs; c++ )
+            for ( cs_len = cs_lens[c], n = 1; n <= max_threads; n++ )
+                run(workers, n, time_ms);
+
+    free(workers);
+    return 0;
+}
+
+/*
+Сравнение блокировок
+
+Урок mutex.c показывает один pthread_mutex_t. Чтобы выбрать замок для конкретного
+горячего участка, нужны цифры. Программа запускает ту же задачу - увеличение общего
+счетчика под замком - от 1 до max_threads потоков для каждого вида замка:
+
+    pthread_mutex   - pthread_mutex_lock()
+    pthread_trylock - pthread_mutex_trylock() в цикле
+    ttas            - спин-блокировка test-and-test-and-set
+    ticket          - билетный замок (строгая очередь)
+    mcs             - очередь MCS, каждый ждет на своей строке кэша
+    futex           - мьютекс на futex с тремя состояниями
+
+(locks.h). Длина критической секции cs_len задается в итерациях пустого цикла.
+Для каждого прогона печатается строка CSV: пропускная способность (захватов в секунду),
+справедливость (индекс Джайна по числу захватов у потоков) и перцентили времени
+захвата p50/p99/p99.9 (latency_hist.h).
+
+Компилируем:
+
+$ g++ -O2 -o lock_bench lock_bench.c -pthread
+
+$ ./lock_bench 8 500 0,100,1000 > locks.csv
+$ head -3 locks.csv
+lock,threads,cs_len,ops_per_sec,fairness,p50_ns,p99_ns,p999_ns,max_ns
+pthread_mutex,1,0,38524612,1.000,20,21,40,11842
+pthread_mutex,2,0,11907830,0.973,64,1088,2816,95011
+
+Спин-блокировки имеет смысл мерить, только когда потоков не больше, чем ядер:
+иначе поток, владеющий замком, вытесняется, а остальные крутятся впустую.
+*/
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "lock_prof.h"
+
+#define LOCK_PROF_SEGMENT "my_lock_prof"
+#define DEFAULT_INTERVAL  1000
+
+void usage(const char * s) {
+    printf("Usage: %s [show|watch [interval_ms]|unlink] [segment]\n", s);
+}
+
+static void print_hist(const char *what, const struct lock_prof_hist *src) {
+    struct lat_hist h;
+
+    lock_prof_hist_snapshot(&h, src);
+    printf("  %-4s mean %10.0f ns, p50 %10llu, p90 %10llu, p99 %10llu, p99.9 %10llu, max %10llu\n",
+           what, lat_hist_mean(&h),
+           (unsigned long long)lat_hist_percentile(&h, 0.50),
+           (unsigned long long)lat_hist_percentile(&h, 0.90),
+           (unsigned long long)lat_hist_percentile(&h, 0.99),
+           (unsigned long long)lat_hist_percentile(&h, 0.999),
+           (unsigned long long)h.max);
+}
+
+static int cmp_holders(const void *a, const void *b) {
+    const struct lock_prof_holder *x = (const struct lock_prof_holder *)a, *y = (const struct lock_prof_holder *)b;
+
+    return x->ns < y->ns ? 1 : x->ns > y->ns ? -1 : 0;
+}
+
+//--- Одна картинка статистики. Счетчики читаются без остановки профилируемого процесса,
+//--- поэтому строки могут немного расходиться между собой.
+static void show(const struct lock_prof_hdr *hdr) {
+    const struct lock_prof_site *s;
+    struct lock_prof_holder top[LOCK_PROF_TOP];
+    uint64_t acquired, contended, now = now_ns();
+    int i, j;
+
+    printf("pid %d, profiling for %.1f s\n", hdr->pid, (now - hdr->started) / 1e9);
+    for ( i = 0; i < LOCK_PROF_SITES; i++ ) {
+        s = &hdr->sites[i];
+        if ( __atomic_load_n(&s->state, __ATOMIC_ACQUIRE) != LOCK_PROF_READY )
+            continue;
+        acquired = __atomic_load_n(&s->acquired, __ATOMIC_RELAXED);
+        contended = __atomic_load_n(&s->contended, __ATOMIC_RELAXED);
+        printf("%s: %llu acquisitions, %llu contended (%.1f%%)\n", s->name,
+               (unsigned long long)acquired, (unsigned long long)contended,
+               acquired ? contended * 100.0 / acquired : 0.0);
+        print_hist("wait", &s->wait);
+        print_hist("hold", &s->hold);
+
+        memcpy(top, s->top, sizeof(top));
+        qsort(top, LOCK_PROF_TOP, sizeof(top[0]), cmp_holders);
+        for ( j = 0; j < LOCK_PROF_TOP && top[j].ns; j++ )
+            printf("  held %10llu ns by %d/%d, %.1f s ago\n", (unsigned long long)top[j].ns,
+                   top[j].pid, top[j].tid, now > top[j].when ? (now - top[j].when) / 1e9 : 0.0);
+    }
+}
+
+int main(int argc, char ** argv) {
+    const char *name = LOCK_PROF_SEGMENT;
+    int watch = 0, interval = DEFAULT_INTERVAL, i;
+    struct lock_prof_hdr *hdr;
+    size_t size = sizeof(struct lock_prof_hdr);
+
+    for ( i = 1; i < argc; i++ ) {
+        if ( !strcmp(argv[i], "show") ) {
+            watch = 0;
+        } else if ( !strcmp(argv[i], "watch") ) {
+            watch = 1;
+            if ( i + 1 < argc && atoi(argv[i + 1]) > 0 )
+                interval = atoi(argv[++i]);
+        } else if ( !strcmp(argv[i], "unlink") ) {
+            if ( shm_unlink(i + 1 < argc ? argv[i + 1] : name) == -1 )
+                perror("shm_unlink");
+            return 0;
+        } else if ( argv[i][0] != '-' ) {
+            name = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if ( (hdr = (struct lock_prof_hdr *)shm_segment_map(name, &size, 0, 0)) == NULL )
+        return 1;
+    if ( size < sizeof(*hdr) || __atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != LOCK_PROF_MAGIC ) {
+        printf("%s is not a lock profile segment\n", name);
+        return 1;
+    }
+
+    do {
+        if ( watch )
+            printf("\033[H\033[2J"); // очистка экрана
+        show(hdr);
+        fflush(stdout);
+    } while ( watch && usleep(interval * 1000) == 0 );
+
+    shm_segment_close(hdr, size);
+    return 0;
+}
+
+/*
+Просмотр статистики блокировок
+
+Читает сегмент, который заполняет профилируемый процесс (lock_prof.h, пример -
+mutex_prof.c), и печатает для каждого места захвата число захватов, долю захватов
+с ожиданием, перцентили времени ожидания и удержания и самые долгие удержания.
+С watch картинка обновляется раз в interval_ms. Профилируемый процесс при этом
+не останавливается и ничего не делает для читателя.
+
+$ ./mutex_prof 2 1000 -a > /dev/null   (в другом окне; ввели 5 и Enter)
+$ ./lock_prof show
+pid 32668, profiling for 2.5 s
+counter@mutex_prof.c:23: 2277 acquisitions, 2271 contended (99.7%)
+  wait mean    1028329 ns, p50     999424, p90    1032192, p99    1277952, p99.9    3407872, max   10166618
+  hold mean    1088888 ns, p50    1048576, p90    1081344, p99    1245184, p99.9    3473408, max    8247768
+  held    8247768 ns by 32668/32673, 1.9 s ago
+  held    6749798 ns by 32668/32673, 1.8 s ago
+  held    3512200 ns by 32668/32673, 0.8 s ago
+  ...
+counter@mutex_prof.c:38: 0 acquisitions, 1 contended (0.0%)
+  wait mean          0 ns, p50          0, p90          0, p99          0, p99.9          0, max          0
+  hold mean          0 ns, p50          0, p90          0, p99          0, p99.9          0, max          0
+counter@mutex_prof.c:40: 1 acquisitions, 1 contended (100.0%)
+  wait mean    1076726 ns, p50    1048576, p90    1048576, p99    1048576, p99.9    1048576, max    1076726
+  hold mean       3916 ns, p50       3904, p90       3904, p99       3904, p99.9       3904, max       3916
+  held       3916 ns by 32668/32674, 1.5 s ago
+
+Неудачный prof_mutex_trylock (строка 38) считается захватом с ожиданием, сам захват
+после него - на строке 40. С watch 500 та же картинка обновляется дважды в секунду.
+
+$ ./lock_prof unlink
+*/
@@ -0,0 +1,293 @@
+#ifndef LOCK_PROF_H
+#define LOCK_PROF_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "ipc_common.h"
+#include "latency_hist.h"
+#include "locks.h"
+#include "shm_segment.h"
+
+//--- Профилировщик блокировок: обертка над pthread_mutex_t, которая для каждого места
+//--- захвата (имя замка + файл:строка) считает захваты, захваты с ожиданием,
+//--- гистограммы времени ожидания и удержания и самые долгие удержания.
+//--- Статистика лежит в именованном сегменте разделяемой памяти, ее читает
+//--- отдельная программа (lock_prof.c) прямо во время работы профилируемого процесса.
+//--- Пока lock_prof_open() не вызван, обертка - это просто pthread_mutex_lock/unlock.
+
+#define LOCK_PROF_MAGIC    0x4c50524f // "LPRO"
+#define LOCK_PROF_SITES    64
+#define LOCK_PROF_TOP      8
+#define LOCK_PROF_NAME_MAX 96
+
+//--- Кэш места вызова: одно 64-битное слово gen * LOCK_PROF_CACHE_BASE + номер записи,
+//--- поэтому поток не увидит запись из одного сегмента с поколением другого.
+//--- Номер LOCK_PROF_NO_SITE - места в сегменте кончились, искать снова не нужно.
+#define LOCK_PROF_NO_SITE    LOCK_PROF_SITES
+#define LOCK_PROF_CACHE_BASE (LOCK_PROF_SITES + 1)
+
+#define LOCK_PROF_FREE    0
+#define LOCK_PROF_FILLING 1
+#define LOCK_PROF_READY   2
+
+//--- Гистограмма в общей памяти: та же разбивка, что у latency_hist.h, но значения
+//--- добавляются атомарно - одно место захвата может работать с разными замками сразу
+struct lock_prof_hist {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t counts[LAT_HIST_BUCKETS];
+};
+
+struct lock_prof_holder {
+    uint64_t ns;   // сколько держали
+    uint64_t when; // когда отпустили (now_ns)
+    int32_t  pid;
+    int32_t  tid;
+};
+
+struct lock_prof_site {
+    uint32_t                state;
+    char                    name[LOCK_PROF_NAME_MAX];
+    uint64_t                acquired  CACHE_ALIGNED;
+    uint64_t                contended;
+    struct ttas_lock        top_lock  CACHE_ALIGNED;
+    uint64_t                top_min;  // меньшее из удержаний в top; пока top не полон - 0
+    struct lock_prof_holder top[LOCK_PROF_TOP];
+    struct lock_prof_hist   wait CACHE_ALIGNED;
+    struct lock_prof_hist   hold CACHE_ALIGNED;
+} CACHE_ALIGNED;
+
+struct lock_prof_hdr {
+    uint32_t              magic;
+    int32_t               pid;
+    uint64_t              started;
+    struct lock_prof_site sites[LOCK_PROF_SITES];
+};
+
+struct prof_mutex {
+    pthread_mutex_t        mutex;
+    const char            *name;
+    struct lock_prof_site *site;      // место последнего захвата, пишет владелец
+    uint64_t               gen;       // поколение сегмента, в котором лежит site
+    uint64_t               locked_at;
+};
+
+#define PROF_MUTEX_INITIALIZER(name) { PTHREAD_MUTEX_INITIALIZER, name, NULL, 0, 0 }
+
+static struct lock_prof_hdr *lock_prof_shm;
+static uint64_t              lock_prof_gen; // растет при каждом open/close: ссылки на записи старого сегмента недействительны
+static __thread int32_t      lock_prof_tid;
+
+//--- Создает (или пересоздает с нуля) сегмент статистики name
+static inline int lock_prof_open(const char *name) {
+    size_t size = sizeof(struct lock_prof_hdr);
+    struct lock_prof_hdr *hdr;
+
+    if ( (hdr = (struct lock_prof_hdr *)shm_segment_map(name, &size, 1, SHM_SEG_POPULATE)) == NULL )
+        return -1;
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->pid = getpid();
+    hdr->started = now_ns();
+    __atomic_store_n(&hdr->magic, LOCK_PROF_MAGIC, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&lock_prof_gen, 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&lock_prof_shm, hdr, __ATOMIC_RELEASE);
+    return 0;
+}
+
+//--- Отключает профилирование. Отображение сегмента намеренно не снимается: поток, который
+//--- уже прочитал lock_prof_shm или m->site и проверил поколение, еще может писать в запись,
+//--- и munmap() здесь превратил бы это в обращение к чужой памяти. Отображение остается
+//--- до конца процесса: каждая пара open/close стоит ~2 МБ адресного пространства (страницы
+//--- объекта с тем же именем общие), поэтому open/close - для редких вызовов, не для цикла.
+static inline void lock_prof_close(void) {
+    __atomic_store_n(&lock_prof_shm, NULL, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&lock_prof_gen, 1, __ATOMIC_RELEASE);
+}
+
+static inline void lock_prof_hist_record(struct lock_prof_hist *h, uint64_t v) {
+    uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+
+    __atomic_fetch_add(&h->counts[lat_hist_index(v)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, v, __ATOMIC_RELAXED);
+    while ( v > max && !__atomic_compare_exchange_n(&h->max, &max, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED) )
+        ;
+}
+
+//--- Снимок гистограммы в обычную lat_hist, чтобы считать перцентили (lat_hist_percentile)
+static inline void lock_prof_hist_snapshot(struct lat_hist *dst, const struct lock_prof_hist *src) {
+    unsigned i;
+
+    lat_hist_init(dst);
+    for ( i = 0; i < LAT_HIST_BUCKETS; i++ ) {
+        dst->counts[i] = __atomic_load_n(&src->counts[i], __ATOMIC_RELAXED);
+        dst->count += dst->counts[i];
+        if ( dst->counts[i] && dst->min == UINT64_MAX )
+            dst->min = lat_hist_value(i);
+    }
+    dst->sum = (double)__atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+    dst->max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+}
+
+//--- Находит или занимает запись для места захвата
+static inline struct lock_prof_site *lock_prof_site(struct lock_prof_hdr *hdr, const char *lock, const char *file, int line) {
+    struct lock_prof_site *s;
+    char name[LOCK_PROF_NAME_MAX];
+    uint32_t state;
+    int i;
+
+    snprintf(name, sizeof(name), "%s@%s:%d", lock ? lock : "?", file, line);
+    for ( i = 0; i < LOCK_PROF_SITES; i++ ) {
+        s = &hdr->sites[i];
+        state = __atomic_load_n(&s->state, __ATOMIC_ACQUIRE);
+        if ( state == LOCK_PROF_READY && !strcmp(s->name, name) )
+            return s;
+        if ( state == LOCK_PROF_FREE &&
+             __atomic_compare_exchange_n(&s->state, &state, LOCK_PROF_FILLING, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED) ) {
+            strcpy(s->name, name);
+            __atomic_store_n(&s->state, LOCK_PROF_READY, __ATOMIC_RELEASE);
+            return s;
+        }
+    }
+    return NULL; // мест нет - это место захвата не профилируется
+}
+
+//--- Запись места вызова через его кэш (см. prof_mutex_lock): поиск по имени - только
+//--- при первом захвате в текущем сегменте; NULL, если места вызову не досталось
+static inline struct lock_prof_site *lock_prof_cached_site(struct lock_prof_hdr *hdr, uint64_t gen, uint64_t *cache,
+                                                           const char *lock, const char *file, int line) {
+    uint64_t c = __atomic_load_n(cache, __ATOMIC_RELAXED);
+    struct lock_prof_site *s;
+
+    if ( c / LOCK_PROF_CACHE_BASE != gen ) {
+        s = lock_prof_site(hdr, lock, file, line);
+        c = gen * LOCK_PROF_CACHE_BASE + (s ? (uint64_t)(s - hdr->sites) : LOCK_PROF_NO_SITE);
+        __atomic_store_n(cache, c, __ATOMIC_RELAXED);
+    }
+    return c % LOCK_PROF_CACHE_BASE == LOCK_PROF_NO_SITE ? NULL : &hdr->sites[c % LOCK_PROF_CACHE_BASE];
+}
+
+//--- Самые долгие удержания: под замком записи, но только если удержание длиннее
+//--- наименьшего из уже сохраненных - обычно это одно сравнение без записи
+static inline void lock_prof_top(struct lock_prof_site *s, uint64_t ns, uint64_t when) {
+    int i, min_i = 0;
+    uint64_t min;
+
+    if ( ns <= __atomic_load_n(&s->top_min, __ATOMIC_RELAXED) )
+        return;
+    if ( !lock_prof_tid )
+        lock_prof_tid = syscall(SYS_gettid);
+    ttas_lock(&s->top_lock);
+    for ( i = 1; i < LOCK_PROF_TOP; i++ )
+        if ( s->top[i].ns < s->top[min_i].ns )
+            min_i = i;
+    if ( ns > s->top[min_i].ns ) {
+        s->top[min_i].ns = ns;
+        s->top[min_i].when = when;
+        s->top[min_i].pid = getpid();
+        s->top[min_i].tid = lock_prof_tid;
+    }
+    for ( min = s->top[0].ns, i = 1; i < LOCK_PROF_TOP; i++ )
+        if ( s->top[i].ns < min )
+            min = s->top[i].ns;
+    __atomic_store_n(&s->top_min, min, __ATOMIC_RELAXED);
+    ttas_unlock(&s->top_lock);
+}
+
+static inline void prof_mutex_init(struct prof_mutex *m, const char *name) {
+    pthread_mutex_init(&m->mutex, NULL);
+    m->name = name;
+    m->site = NULL;
+    m->gen = 0;
+    m->locked_at = 0;
+}
+
+//--- Захват. cache - запись места захвата, найденная в прошлый раз (см. prof_mutex_lock)
+static inline int prof_mutex_lock_at(struct prof_mutex *m, uint64_t *cache, const char *file, int line) {
+    struct lock_prof_hdr *hdr;
+    struct lock_prof_site *s;
+    uint64_t t0, t1, gen = __atomic_load_n(&lock_prof_gen, __ATOMIC_ACQUIRE);
+    int rc, contended;
+
+    if ( (hdr = __atomic_load_n(&lock_prof_shm, __ATOMIC_ACQUIRE)) == NULL )
+        return pthread_mutex_lock(&m->mutex);
+    s = lock_prof_cached_site(hdr, gen, cache, m->name, file, line);
+
+    t0 = now_ns();
+    //--- trylock отличает свободный замок от занятого без лишнего системного вызова
+    if ( (contended = (rc = pthread_mutex_trylock(&m->mutex)) == EBUSY) )
+        rc = pthread_mutex_lock(&m->mutex);
+    if ( rc )
+        return rc;
+    t1 = now_ns();
+
+    m->site = s;
+    m->gen = gen;
+    m->locked_at = t1;
+    if ( s ) {
+        __atomic_fetch_add(&s->acquired, 1, __ATOMIC_RELAXED);
+        if ( contended )
+            __atomic_fetch_add(&s->contended, 1, __ATOMIC_RELAXED);
+        lock_prof_hist_record(&s->wait, t1 - t0);
+    }
+    return 0;
+}
+
+//--- Попытка захвата: неудача считается захватом с ожиданием, удача - захватом без ожидания
+static inline int prof_mutex_trylock_at(struct prof_mutex *m, uint64_t *cache, const char *file, int line) {
+    struct lock_prof_hdr *hdr;
+    struct lock_prof_site *s;
+    uint64_t gen = __atomic_load_n(&lock_prof_gen, __ATOMIC_ACQUIRE);
+    int rc = pthread_mutex_trylock(&m->mutex);
+
+    if ( (hdr = __atomic_load_n(&lock_prof_shm, __ATOMIC_ACQUIRE)) == NULL )
+        return rc;
+    s = lock_prof_cached_site(hdr, gen, cache, m->name, file, line);
+    if ( rc == 0 ) {
+        m->site = s;
+        m->gen = gen;
+        m->locked_at = now_ns();
+    }
+    if ( s ) {
+        if ( rc == EBUSY )
+            __atomic_fetch_add(&s->contended, 1, __ATOMIC_RELAXED);
+        else if ( rc == 0 ) {
+            __atomic_fetch_add(&s->acquired, 1, __ATOMIC_RELAXED);
+            lock_prof_hist_record(&s->wait, 0);
+        }
+    }
+    return rc;
+}
+
+static inline int prof_mutex_unlock(struct prof_mutex *m) {
+    struct lock_prof_site *s = m->site;
+    uint64_t now, ns;
+
+    //--- сегмент, в котором захват был отмечен, могли закрыть (и открыть новый)
+    if ( s && m->gen == __atomic_load_n(&lock_prof_gen, __ATOMIC_ACQUIRE) ) {
+        m->site = NULL;
+        now = now_ns();
+        ns = now - m->locked_at;
+        lock_prof_hist_record(&s->hold, ns);
+        lock_prof_top(s, ns, now);
+    }
+    return pthread_mutex_unlock(&m->mutex);
+}
+
+//--- У каждого места вызова свой статический кэш записи статистики (lock_prof_cached_site):
+//--- поиск по имени делается один раз на сегмент, дальше захват стоит двух чтений часов
+#define prof_mutex_lock(m) ({ \
+    static uint64_t lock_prof_site_; \
+    prof_mutex_lock_at((m), &lock_prof_site_, __FILE__, __LINE__); })
+
+#define prof_mutex_trylock(m) ({ \
+    static uint64_t lock_prof_site_; \
+    prof_mutex_trylock_at((m), &lock_prof_site_, __FILE__, __LINE__); })
+
+#endif
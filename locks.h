@@ -0,0 +1,113 @@
+#ifndef LOCKS_H
+#define LOCKS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/futex.h>
+#include "ipc_common.h"
+#include "futex_wait.h"
+
+//--- Самодельные блокировки для сравнения с pthread_mutex_t.
+
+//--- TTAS (test-and-test-and-set): крутимся на обычном чтении, которое обслуживается
+//--- из своего кэша, и пытаемся захватить только когда замок выглядит свободным.
+struct ttas_lock {
+    uint32_t locked;
+};
+
+static inline void ttas_lock(struct ttas_lock *l) {
+    for ( ;; ) {
+        while ( __atomic_load_n(&l->locked, __ATOMIC_RELAXED) )
+            cpu_relax();
+        if ( !__atomic_exchange_n(&l->locked, 1, __ATOMIC_ACQUIRE) )
+            return;
+    }
+}
+
+static inline void ttas_unlock(struct ttas_lock *l) {
+    __atomic_store_n(&l->locked, 0, __ATOMIC_RELEASE);
+}
+
+//--- Билетный замок: потоки получают номера по порядку и входят строго по очереди (FIFO).
+struct ticket_lock {
+    uint32_t next;
+    uint32_t serving;
+};
+
+static inline void ticket_lock(struct ticket_lock *l) {
+    uint32_t my = __atomic_fetch_add(&l->next, 1, __ATOMIC_RELAXED);
+
+    while ( __atomic_load_n(&l->serving, __ATOMIC_ACQUIRE) != my )
+        cpu_relax();
+}
+
+static inline void ticket_unlock(struct ticket_lock *l) {
+    __atomic_store_n(&l->serving, __atomic_load_n(&l->serving, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+}
+
+//--- MCS: очередь ожидающих, каждый крутится на флаге в своем узле (своей строке кэша),
+//--- поэтому освобождение замка трогает кэш только следующего в очереди.
+struct mcs_node {
+    struct mcs_node *next;
+    uint32_t         locked;
+} CACHE_ALIGNED;
+
+struct mcs_lock {
+    struct mcs_node *tail;
+};
+
+static inline void mcs_lock(struct mcs_lock *l, struct mcs_node *me) {
+    struct mcs_node *prev;
+
+    me->next = NULL;
+    me->locked = 1;
+    prev = __atomic_exchange_n(&l->tail, me, __ATOMIC_ACQ_REL);
+    if ( prev == NULL )
+        return;
+    __atomic_store_n(&prev->next, me, __ATOMIC_RELEASE);
+    while ( __atomic_load_n(&me->locked, __ATOMIC_ACQUIRE) )
+        cpu_relax();
+}
+
+static inline void mcs_unlock(struct mcs_lock *l, struct mcs_node *me) {
+    struct mcs_node *next = __atomic_load_n(&me->next, __ATOMIC_ACQUIRE);
+    struct mcs_node *expected = me;
+
+    if ( next == NULL ) {
+        //--- очередь пуста - освобождаем замок; если кто-то как раз встает в очередь, ждем его
+        if ( __atomic_compare_exchange_n(&l->tail, &expected, NULL, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED) )
+            return;
+        while ( (next = __atomic_load_n(&me->next, __ATOMIC_ACQUIRE)) == NULL )
+            cpu_relax();
+    }
+    __atomic_store_n(&next->locked, 0, __ATOMIC_RELEASE);
+}
+
+//--- Мьютекс на futex с тремя состояниями (U. Drepper, "Futexes Are Tricky"):
+//--- 0 - свободен, 1 - занят, 2 - занят и есть ожидающие.
+//--- Без конкуренции захват и освобождение - одна атомарная операция без системных вызовов.
+struct futex_mutex {
+    uint32_t state;
+};
+
+static inline void futex_mutex_lock(struct futex_mutex *m) {
+    uint32_t c = 0;
+
+    if ( __atomic_compare_exchange_n(&m->state, &c, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED) )
+        return;
+    if ( c != 2 )
+        c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+    while ( c != 0 ) {
+        futex(&m->state, FUTEX_WAIT_PRIVATE, 2, NULL);
+        c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+static inline void futex_mutex_unlock(struct futex_mutex *m) {
+    if ( __atomic_fetch_sub(&m->state, 1, __ATOMIC_RELEASE) != 1 ) {
+        __atomic_store_n(&m->state, 0, __ATOMIC_RELEASE);
+        futex(&m->state, FUTEX_WAKE_PRIVATE, 1, NULL);
+    }
+}
+
+#endif
@@ -0,0 +1,256 @@
+#ifndef MEMFD_POOL_H
+#define MEMFD_POOL_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // memfd_create(), F_ADD_SEALS
+#endif
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "fd_pass.h"
+
+//--- Передача больших блоков без копирования: производитель пишет данные в память memfd
+//--- и отправляет по сокету UNIX (SOCK_SEQPACKET) только номер буфера и длину.
+//--- Сам дескриптор уходит (SCM_RIGHTS) лишь при первой отправке буфера: потребитель
+//--- отображает его только на чтение один раз и дальше узнает буфер по номеру.
+//--- Прочитав блок, потребитель возвращает номер, и буфер снова попадает в пул.
+//--- Все буферы выделяются и заполняются страницами заранее (MAP_POPULATE), поэтому
+//--- на горячем пути нет ни memfd_create(), ни mmap(), ни страничных ошибок.
+//---
+//--- Печати: F_SEAL_SHRINK|F_SEAL_GROW - размер не изменится, и отображение у потребителя
+//--- не получит SIGBUS; F_SEAL_FUTURE_WRITE - никто не откроет буфер на запись заново
+//--- (ни mmap(PROT_WRITE), ни write()), пишет только уже созданное отображение производителя.
+//--- F_SEAL_WRITE запретил бы и его, но снять печать нельзя, т.е. буфер стал бы одноразовым.
+
+#ifndef F_SEAL_FUTURE_WRITE
+#define F_SEAL_FUTURE_WRITE 0x0010 // Linux 5.1
+#endif
+
+#define MEMFD_POOL_MAX   64
+#define MEMFD_POOL_SEALS (F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_FUTURE_WRITE|F_SEAL_SEAL)
+
+//--- Сообщение производителя; потребитель отвечает тем же с len = 0 - буфер свободен
+struct memfd_msg {
+    uint32_t id;
+    uint32_t pad;
+    uint64_t len;
+};
+
+struct memfd_buf {
+    int       fd;
+    uint32_t  id;
+    char     *addr;
+    int       sent; // дескриптор уже у потребителя
+    int       busy; // буфер не в списке свободных: у производителя или у потребителя
+};
+
+struct memfd_pool {
+    int              sock;
+    int              count;
+    size_t           size;     // размер каждого буфера
+    int              nfree;
+    int              free_ids[MEMFD_POOL_MAX];
+    uint64_t         waits;    // сколько раз производитель ждал свободный буфер
+    struct memfd_buf bufs[MEMFD_POOL_MAX];
+};
+
+//--- У потребителя: отображения буферов по номеру
+struct memfd_view {
+    const char *addr[MEMFD_POOL_MAX];
+    size_t      size[MEMFD_POOL_MAX];
+};
+
+//--- Создает count буферов по size байт, отображенных и запечатанных
+static inline int memfd_pool_init(struct memfd_pool *pool, int sock, int count, size_t size) {
+    struct memfd_buf *b;
+    int i;
+
+    memset(pool, 0, sizeof(*pool));
+    if ( count < 1 || count > MEMFD_POOL_MAX ) {
+        errno = EINVAL;
+        return -1;
+    }
+    pool->sock = sock;
+    pool->size = size;
+    for ( i = 0; i < count; i++ ) {
+        b = &pool->bufs[i];
+        b->id = i;
+        if ( (b->fd = memfd_create("memfd_pool", MFD_CLOEXEC|MFD_ALLOW_SEALING)) == -1 ) {
+            perror("memfd_create");
+            return -1;
+        }
+        pool->count++;
+        if ( ftruncate(b->fd, size) == -1 ) {
+            perror("ftruncate");
+            return -1;
+        }
+        //--- отображение на запись создается до печати F_SEAL_FUTURE_WRITE
+        b->addr = (char *)mmap(0, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, b->fd, 0);
+        if ( b->addr == (char *)MAP_FAILED ) {
+            perror("mmap");
+            b->addr = NULL;
+            return -1;
+        }
+        if ( fcntl(b->fd, F_ADD_SEALS, MEMFD_POOL_SEALS) == -1 ) {
+            perror("F_ADD_SEALS");
+            return -1;
+        }
+        pool->free_ids[pool->nfree++] = i;
+    }
+    return 0;
+}
+
+static inline void memfd_pool_free(struct memfd_pool *pool) {
+    int i;
+
+    for ( i = 0; i < pool->count; i++ ) {
+        if ( pool->bufs[i].addr )
+            munmap(pool->bufs[i].addr, pool->size);
+        close(pool->bufs[i].fd);
+    }
+    pool->count = pool->nfree = 0;
+}
+
+//--- Забирает возвраты буферов от потребителя. block - ждать хотя бы один.
+//--- Возвращает число вернувшихся буферов или -1 (потребитель отключился).
+static inline int memfd_pool_reclaim(struct memfd_pool *pool, int block) {
+    struct memfd_msg msg;
+    ssize_t n;
+    int got = 0;
+
+    for ( ;; ) {
+        n = recv(pool->sock, &msg, sizeof(msg), (block && !got) ? 0 : MSG_DONTWAIT);
+        if ( n == -1 && errno == EINTR )
+            continue;
+        if ( n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK) )
+            return got;
+        if ( n != (ssize_t)sizeof(msg) || msg.id >= (uint32_t)pool->count ) {
+            if ( n == 0 )
+                errno = ECONNRESET;
+            return -1;
+        }
+        //--- вернуть можно только выданный буфер: повтор переполнил бы free_ids
+        if ( !pool->bufs[msg.id].busy || pool->nfree >= pool->count ) {
+            errno = EBADMSG;
+            return -1;
+        }
+        pool->bufs[msg.id].busy = 0;
+        pool->free_ids[pool->nfree++] = msg.id;
+        got++;
+    }
+}
+
+//--- Свободный буфер для следующего блока; если все у потребителя - ждет возврата
+static inline struct memfd_buf *memfd_pool_get(struct memfd_pool *pool) {
+    struct memfd_buf *b;
+
+    if ( !pool->nfree ) {
+        pool->waits++;
+        if ( memfd_pool_reclaim(pool, 1) <= 0 )
+            return NULL;
+    }
+    b = &pool->bufs[pool->free_ids[--pool->nfree]];
+    b->busy = 1;
+    return b;
+}
+
+//--- Отдает потребителю len байт, записанных в b->addr
+static inline int memfd_pool_send(struct memfd_pool *pool, struct memfd_buf *b, size_t len) {
+    struct memfd_msg msg = { b->id, 0, len };
+
+    if ( !b->sent ) {
+        if ( fd_pass_send(pool->sock, b->fd, &msg, sizeof(msg)) == -1 )
+            return -1;
+        b->sent = 1;
+        return 0;
+    }
+    while ( send(pool->sock, &msg, sizeof(msg), MSG_NOSIGNAL) == -1 ) {
+        if ( errno != EINTR )
+            return -1;
+    }
+    return 0;
+}
+
+//--- Потребитель: проверяет печати нового буфера и отображает его только на чтение
+static inline int memfd_view_map(struct memfd_view *v, uint32_t id, int fd) {
+    struct stat st;
+    int seals;
+    void *addr;
+
+    //--- без печатей производитель мог бы уменьшить файл, и чтение упало бы с SIGBUS
+    if ( (seals = fcntl(fd, F_GET_SEALS)) == -1 ||
+         (seals & (F_SEAL_SHRINK|F_SEAL_GROW)) != (F_SEAL_SHRINK|F_SEAL_GROW) ) {
+        fprintf(stderr, "memfd %u is not sealed\n", id);
+        close(fd);
+        return -1;
+    }
+    if ( fstat(fd, &st) == -1 ) {
+        perror("fstat");
+        close(fd);
+        return -1;
+    }
+    addr = mmap(0, st.st_size, PROT_READ, MAP_SHARED|MAP_POPULATE, fd, 0);
+    close(fd); // отображение держит memfd и без дескриптора
+    if ( addr == MAP_FAILED ) {
+        perror("mmap");
+        return -1;
+    }
+    if ( v->addr[id] )
+        munmap((void *)v->addr[id], v->size[id]);
+    v->addr[id] = (const char *)addr;
+    v->size[id] = st.st_size;
+    return 0;
+}
+
+//--- Потребитель: следующий блок. Возвращает адрес данных (длина - в msg->len),
+//--- NULL и errno = 0 - производитель закрыл соединение.
+static inline const char *memfd_view_recv(struct memfd_view *v, int sock, struct memfd_msg *msg) {
+    ssize_t n;
+    int fd;
+
+    if ( (n = fd_pass_recvmsg(sock, msg, sizeof(*msg), &fd)) <= 0 ) {
+        if ( n == 0 )
+            errno = 0;
+        return NULL;
+    }
+    if ( n != (ssize_t)sizeof(*msg) || msg->id >= MEMFD_POOL_MAX ) {
+        if ( fd != -1 )
+            close(fd);
+        errno = EBADMSG;
+        return NULL;
+    }
+    if ( fd != -1 && memfd_view_map(v, msg->id, fd) == -1 )
+        return NULL;
+    if ( !v->addr[msg->id] || msg->len > v->size[msg->id] ) {
+        errno = EBADMSG;
+        return NULL;
+    }
+    return v->addr[msg->id];
+}
+
+//--- Потребитель: блок прочитан, буфер можно использовать снова
+static inline int memfd_view_release(int sock, uint32_t id) {
+    struct memfd_msg msg = { id, 0, 0 };
+
+    while ( send(sock, &msg, sizeof(msg), MSG_NOSIGNAL) == -1 ) {
+        if ( errno != EINTR )
+            return -1;
+    }
+    return 0;
+}
+
+static inline void memfd_view_free(struct memfd_view *v) {
+    int i;
+
+    for ( i = 0; i < MEMFD_POOL_MAX; i++ )
+        if ( v->addr[i] )
+            munmap((void *)v->addr[i], v->size[i]);
+    memset(v, 0, sizeof(*v));
+}
+
+#endif
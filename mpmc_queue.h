@@ -0,0 +1,125 @@
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <stdint.h>
+#include <string.h>
+#include "ipc_common.h"
+
+//--- Ограниченная очередь "много писателей - много читателей" в разделяемой памяти.
+//--- У каждой ячейки свой номер последовательности seq, позиции записи и чтения
+//--- продвигаются через CAS. Подключиться к очереди может любой процесс, знающий ее имя.
+
+#define MPMC_QUEUE_MAGIC   0x4d504d43 // "MPMC"
+#define MPMC_QUEUE_MSG_MAX (CACHE_LINE_SIZE - sizeof(uint64_t) - sizeof(uint32_t))
+
+//--- Ячейка занимает ровно одну строку кэша.
+//--- seq == pos           : ячейка свободна и ждет писателя с позицией pos
+//--- seq == pos + 1       : ячейка заполнена и ждет читателя с позицией pos
+//--- seq == pos + capacity: ячейка прочитана и свободна для следующего круга
+struct mpmc_cell {
+    uint64_t seq;
+    uint32_t len;
+    char     data[MPMC_QUEUE_MSG_MAX];
+} CACHE_ALIGNED;
+
+struct mpmc_queue_hdr {
+    uint32_t magic;
+    uint32_t capacity;    // степень двойки
+    uint64_t enqueue_pos CACHE_ALIGNED;
+    uint64_t dequeue_pos CACHE_ALIGNED;
+} CACHE_ALIGNED;
+
+struct mpmc_queue {
+    struct mpmc_queue_hdr *hdr;
+    struct mpmc_cell      *cells;
+    uint64_t               mask;
+};
+
+static inline size_t mpmc_queue_size(uint32_t capacity) {
+    return sizeof(struct mpmc_queue_hdr) + (size_t)capacity * sizeof(struct mpmc_cell);
+}
+
+//--- Разметка свежей памяти. Вызывается один раз создателем сегмента.
+static inline int mpmc_queue_init(void *mem, uint32_t capacity) {
+    struct mpmc_queue_hdr *hdr = (struct mpmc_queue_hdr *)mem;
+    struct mpmc_cell *cells = (struct mpmc_cell *)(hdr + 1);
+    uint32_t i;
+
+    if ( !capacity || (capacity & (capacity - 1)) )
+        return -1;
+    hdr->capacity = capacity;
+    hdr->enqueue_pos = 0;
+    hdr->dequeue_pos = 0;
+    for ( i = 0; i < capacity; i++ )
+        cells[i].seq = i;
+    __atomic_store_n(&hdr->magic, MPMC_QUEUE_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static inline int mpmc_queue_attach(struct mpmc_queue *q, void *mem) {
+    q->hdr = (struct mpmc_queue_hdr *)mem;
+    if ( __atomic_load_n(&q->hdr->magic, __ATOMIC_ACQUIRE) != MPMC_QUEUE_MAGIC )
+        return -1;
+    q->cells = (struct mpmc_cell *)(q->hdr + 1);
+    q->mask = q->hdr->capacity - 1;
+    return 0;
+}
+
+//--- Кладет сообщение. Возвращает 0 или -1, если очередь заполнена.
+static inline int mpmc_queue_push(struct mpmc_queue *q, const void *data, uint32_t len) {
+    struct mpmc_cell *cell;
+    uint64_t pos = __atomic_load_n(&q->hdr->enqueue_pos, __ATOMIC_RELAXED);
+    int64_t diff;
+
+    for ( ;; ) {
+        cell = &q->cells[pos & q->mask];
+        diff = (int64_t)__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (int64_t)pos;
+        if ( diff == 0 ) {
+            //--- ячейка свободна: пытаемся забрать позицию себе (при неудаче pos обновится)
+            if ( __atomic_compare_exchange_n(&q->hdr->enqueue_pos, &pos, pos + 1, 1,
+                                             __ATOMIC_RELAXED, __ATOMIC_RELAXED) )
+                break;
+        } else if ( diff < 0 ) {
+            return -1; // читатели еще не освободили ячейку с прошлого круга
+        } else {
+            pos = __atomic_load_n(&q->hdr->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    if ( len > MPMC_QUEUE_MSG_MAX )
+        len = MPMC_QUEUE_MSG_MAX;
+    cell->len = len;
+    memcpy(cell->data, data, len);
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+//--- Забирает сообщение в buf (не более size байт).
+//--- Возвращает длину сообщения или -1, если очередь пуста.
+static inline int mpmc_queue_pop(struct mpmc_queue *q, void *buf, uint32_t size) {
+    struct mpmc_cell *cell;
+    uint64_t pos = __atomic_load_n(&q->hdr->dequeue_pos, __ATOMIC_RELAXED);
+    int64_t diff;
+    uint32_t len;
+
+    for ( ;; ) {
+        cell = &q->cells[pos & q->mask];
+        diff = (int64_t)__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (int64_t)(pos + 1);
+        if ( diff == 0 ) {
+            if ( __atomic_compare_exchange_n(&q->hdr->dequeue_pos, &pos, pos + 1, 1,
+                                             __ATOMIC_RELAXED, __ATOMIC_RELAXED) )
+                break;
+        } else if ( diff < 0 ) {
+            return -1; // писатель еще не заполнил ячейку
+        } else {
+            pos = __atomic_load_n(&q->hdr->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    len = (cell->len <= size) ? cell->len : size;
+    memcpy(buf, cell->data, len);
+    __atomic_store_n(&cell->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+    return len;
+}
+
+#endif
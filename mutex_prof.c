@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include "lock_prof.h"
+#include "async_log.h"
+#include "cpu_affinity.h"
+
+#define LOCK_PROF_SEGMENT "my_lock_prof"
+#define MAX_THREADS       64
+
+static int counter; // shared resource
+static struct prof_mutex mutex = PROF_MUTEX_INITIALIZER("counter");
+static int hold_us = 1000;
+
+//--- Как в mutex.c: замок держится на время printf и паузы, только пауза короче.
+//--- С -a строка лишь копируется в буфер потока, а печатает ее фоновый поток (async_log.h).
+void *incr_counter(void *p) {
+    do {
+        usleep(10); // Let's have a time slice between mutex locks
+        prof_mutex_lock(&mutex);
+        counter++;
+        async_log_printf("%d\n", counter);
+        usleep(hold_us);
+        prof_mutex_unlock(&mutex);
+    } while ( 1 );
+    return NULL;
+}
+
+void *reset_counter(void *p) {
+    char buf[32];
+    int  rc;
+
+    printf("Enter the number and press 'Enter' to initialize the counter with new value anytime.\n");
+    while ( fgets(buf, sizeof(buf), stdin) == buf ) {
+        if ( (rc = prof_mutex_trylock(&mutex)) == EBUSY ) {
+            printf("Mutex is already locked by another thread.\nLet's lock mutex using pthread_mutex_lock().\n");
+            prof_mutex_lock(&mutex);
+        } else if ( rc != 0 ) {
+            printf("Error: %d\n", rc);
+            return NULL;
+        }
+        counter = atoi(buf);
+        printf("New value for counter is %d\n", counter);
+        prof_mutex_unlock(&mutex);
+    }
+    return NULL;
+}
+
+int main(int argc, char ** argv) {
+    pthread_t threads[MAX_THREADS];
+    pthread_t thread_reset;
+    pthread_attr_t attr;
+    static struct cpu_affinity affinity;
+    int i, nthreads, async = 0;
+
+    if ( cpu_affinity_init(&affinity, &argc, argv) == -1 )
+        return 1;
+    if ( argc >= 2 && !strcmp(argv[argc - 1], "-a") ) {
+        async = 1;
+        argc--;
+    }
+    nthreads = (argc >= 2) ? atoi(argv[1]) : 2;
+
+    if ( argc >= 3 )
+        hold_us = atoi(argv[2]);
+    if ( nthreads < 1 || nthreads > MAX_THREADS || hold_us < 0 || argc > 3 ) {
+        printf("Usage: %s [threads 1..%d] [hold_us] [-a] [--cpus list|pair|smt|remote]\n", argv[0], MAX_THREADS);
+        return 1;
+    }
+    if ( lock_prof_open(LOCK_PROF_SEGMENT) == -1 )
+        return 1;
+    if ( async && async_log_start(STDOUT_FILENO) == -1 )
+        return 1;
+
+    //--- потоки счетчика раздаются по процессорам из --cpus/IPC_CPUS по кругу
+    for ( i = 0; i < nthreads; i++ ) {
+        if ( cpu_affinity_attr(&attr, cpu_affinity_next(&affinity)) == -1 )
+            return 1;
+        pthread_create(&threads[i], &attr, incr_counter, NULL);
+        pthread_attr_destroy(&attr);
+    }
+    pthread_create(&thread_reset, NULL, reset_counter, NULL);
+
+    pthread_join(thread_reset, NULL);
+    async_log_stop();
+    //--- потоки incr_counter не завершаются: выходим вместе с ними, сегмент остается для lock_prof
+    return 0;
+}
+
+/*
+Профилирование мьютекса
+
+В mutex.c поток incr_counter держит мьютекс на время printf() и sleep(1), и второй
+поток подолгу ждет. Увидеть такое без perf сложно, поэтому здесь тот же счетчик
+защищен оберткой prof_mutex (lock_prof.h). Для каждого места захвата (имя замка
+и файл:строка) она считает:
+
+    - число захватов и сколько из них пришлось ждать (trylock вернул EBUSY);
+    - гистограммы времени ожидания и удержания (latency_hist.h);
+    - LOCK_PROF_TOP самых долгих удержаний: сколько, когда, каким потоком.
+
+Все это лежит в сегменте разделяемой памяти my_lock_prof, и программа lock_prof
+читает его, пока профилируемый процесс работает. Захват без профилирования
+(lock_prof_open() не вызван) стоит одной проверки указателя.
+
+Компилируем:
+
+$ g++ -O2 -o mutex_prof mutex_prof.c -pthread -lrt
+$ g++ -O2 -o lock_prof lock_prof.c -pthread -lrt
+
+$ ./mutex_prof 4 1000 > /dev/null
+
+В соседнем окне:
+
+$ ./lock_prof watch
+
+С ключом -a printf() под замком заменяется записью в буфер асинхронного журнала
+(async_log.h), и время удержания в lock_prof уменьшается на время самого вывода:
+
+$ ./mutex_prof 4 0 -a > /dev/null
+
+Насколько дорого ожидание, зависит и от того, где работают потоки: замок, который
+передается между гиперпотоками одного ядра, и замок, который ходит между сокетами, -
+разные замки. Ключ --cpus (или IPC_CPUS) раздает потоки счетчика по процессорам
+(cpu_affinity.h); топология и выбор печатаются в stderr:
+
+$ ./mutex_prof 2 0 -a --cpus smt > /dev/null
+$ IPC_CPUS=remote ./mutex_prof 2 0 -a > /dev/null
+*/
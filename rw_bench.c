@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "ipc_common.h"
+#include "cpu_affinity.h"
+#include "rw_sync.h"
+
+#define MAX_READERS     RW_SYNC_SLOTS
+#define DEFAULT_TIME_MS 500
+#define DEFAULT_WRITE_US 1000
+#define WRITE_WORK      200 // работа писателя между половинками изменения
+
+//--- Состояние, которое читают: счетчик и его контрольная копия. Писатель меняет их
+//--- не одновременно, поэтому читатель без синхронизации увидел бы check != ~value.
+struct counter_state {
+    long value;
+    long check;
+};
+
+struct reader {
+    pthread_t tid;
+    long      reads;
+    long      torn;  // прочитано несогласованное состояние
+} CACHE_ALIGNED;
+
+static struct rw_sync sync_state;
+static volatile int stop;
+static pthread_barrier_t start_barrier;
+static int write_us = DEFAULT_WRITE_US;
+static long writes;
+
+static inline void busy_work(int n) {
+    for ( int i = 0; i < n; i++ )
+        __asm__ __volatile__("" ::: "memory");
+}
+
+void *read_counter(void *p) {
+    struct reader *r = (struct reader *)p;
+    const struct counter_state *st;
+    struct rw_reader me;
+    long value, check;
+
+    if ( rw_sync_reader(&sync_state, &me) == -1 ) {
+        perror("rw_sync_reader");
+        pthread_barrier_wait(&start_barrier);
+        return NULL;
+    }
+    pthread_barrier_wait(&start_barrier);
+    while ( !stop ) {
+        st = (const struct counter_state *)rw_sync_read_lock(&sync_state, &me);
+        value = st->value;
+        check = st->check;
+        rw_sync_read_unlock(&sync_state, &me);
+        r->torn += check != ~value;
+        r->reads++;
+    }
+    return NULL;
+}
+
+//--- Фоновый писатель: раз в write_us меняет счетчик, как reset_counter в mutex.c
+void *write_counter(void *p) {
+    struct counter_state *st;
+
+    pthread_barrier_wait(&start_barrier);
+    while ( !stop ) {
+        if ( write_us )
+            usleep(write_us);
+        st = (struct counter_state *)rw_sync_write_lock(&sync_state);
+        st->value++;
+        busy_work(WRITE_WORK);
+        st->check = ~st->value;
+        rw_sync_write_unlock(&sync_state);
+        writes++;
+    }
+    return NULL;
+}
+
+//--- Один прогон: nreaders читателей и писатель, синхронизация kind
+void run(struct reader *readers, int kind, int nreaders, int time_ms, struct cpu_affinity *affinity) {
+    struct counter_state init = { 0, ~0L };
+    pthread_t writer;
+    pthread_attr_t attr;
+    long reads = 0, torn = 0;
+    int i;
+
+    if ( rw_sync_init(&sync_state, kind, &init, sizeof(init)) == -1 ) {
+        perror("rw_sync_init");
+        return;
+    }
+    stop = 0;
+    writes = 0;
+    affinity->next = 0;
+    pthread_barrier_init(&start_barrier, NULL, nreaders + 2);
+    for ( i = 0; i < nreaders; i++ ) {
+        readers[i].reads = readers[i].torn = 0;
+        cpu_affinity_attr(&attr, cpu_affinity_next(affinity));
+        pthread_create(&readers[i].tid, &attr, read_counter, &readers[i]);
+        pthread_attr_destroy(&attr);
+    }
+    cpu_affinity_attr(&attr, cpu_affinity_next(affinity));
+    pthread_create(&writer, &attr, write_counter, NULL);
+    pthread_attr_destroy(&attr);
+    pthread_barrier_wait(&start_barrier);
+    usleep(time_ms * 1000);
+    stop = 1;
+
+    pthread_join(writer, NULL);
+    for ( i = 0; i < nreaders; i++ ) {
+        pthread_join(readers[i].tid, NULL);
+        reads += readers[i].reads;
+        torn += readers[i].torn;
+    }
+    pthread_barrier_destroy(&start_barrier);
+    rw_sync_destroy(&sync_state);
+
+    if ( torn )
+        fprintf(stderr, "%s: %ld torn reads, the synchronisation is broken\n", rw_sync_names[kind], torn);
+    printf("%s,%d,%.0f,%.0f,%.0f,%ld\n", rw_sync_names[kind], nreaders, reads * 1000.0 / time_ms,
+           reads * 1000.0 / time_ms / nreaders, writes * 1000.0 / time_ms, torn);
+    fflush(stdout);
+}
+
+int main(int argc, char ** argv) {
+    struct reader *readers;
+    static struct cpu_affinity affinity;
+    int max_readers = sysconf(_SC_NPROCESSORS_ONLN);
+    int time_ms = DEFAULT_TIME_MS;
+    int kind, first = 0, last = RW_SYNC_KINDS - 1, n;
+
+    if ( max_readers > MAX_READERS )
+        max_readers = MAX_READERS;
+    if ( cpu_affinity_init(&affinity, &argc, argv) == -1 )
+        return 1;
+    //--- последним аргументом можно выбрать одну реализацию
+    if ( argc >= 2 ) {
+        for ( kind = 0; kind < RW_SYNC_KINDS; kind++ )
+            if ( !strcmp(argv[argc - 1], rw_sync_names[kind]) )
+                break;
+        if ( kind < RW_SYNC_KINDS ) {
+            first = last = kind;
+            argc--;
+        }
+    }
+    if ( argc >= 2 )
+        max_readers = atoi(argv[1]);
+    if ( argc >= 3 )
+        time_ms = atoi(argv[2]);
+    if ( argc >= 4 )
+        write_us = atoi(argv[3]);
+    if ( max_readers < 1 || max_readers > MAX_READERS || time_ms < 1 || write_us < 0 || argc > 4 ) {
+        printf("Usage: %s [max_readers 1..%d] [time_ms] [write_us] [mutex|rwlock|brlock|rcu] [--cpus list|pair|smt|remote]\n",
+               argv[0], MAX_READERS);
+        return 1;
+    }
+
+    if ( posix_memalign((void **)&readers, CACHE_LINE_SIZE, max_readers * sizeof(struct reader)) ) {
+        perror("posix_memalign");
+        return 1;
+    }
+
+    printf("sync,readers,reads_per_sec,reads_per_sec_per_reader,writes_per_sec,torn\n");
+    for ( kind = first; kind <= last; kind++ )
+        for ( n = 1; n <= max_readers; n++ )
+            run(readers, kind, n, time_ms, &affinity);
+
+    free(readers);
+    return 0;
+}
+
+/*
+Синхронизация для данных, которые в основном читают
+
+В mutex.c счетчик защищен одним pthread_mutex_t: и поток, который его сбрасывает,
+и все, кто его читает, входят по одному. Сброс редок, а чтения идут постоянно,
+поэтому исключительный замок заставляет читателей ждать друг друга без всякой нужды.
+rw_sync.h предлагает за одним интерфейсом несколько вариантов:
+
+    mutex   - как в mutex.c, для сравнения;
+    rwlock  - pthread_rwlock_t с приоритетом писателя. Читатели входят одновременно,
+              но каждый rdlock/unlock - атомарная операция над общим словом замка,
+              и строка кэша с ним мигрирует между ядрами на каждом чтении;
+    brlock  - "big-reader lock": у каждого процессора свой счетчик читателей в своей
+              строке кэша (sched_getcpu()). Чтение трогает только свою строку и читает
+              флаг писателя, который у всех в кэше. Зато писатель проходит по всем ячейкам;
+    rcu     - читатели вообще не пишут в общую память: записывают эпоху в свою ячейку
+              и читают указатель на опубликованную версию. Писатель меняет копию,
+              публикует ее и ждет конца всех начатых чтений (rcu_synchronize), после
+              чего старая версия свободна. Если есть membarrier(2), барьер за читателей
+              выполняет писатель, и на чтение не приходится ни одной атомарной инструкции.
+
+Цена падает на писателя: brlock проходит по 64 ячейкам, а rcu копирует данные и ждет
+период ожидания, поэтому они подходят только для действительно редких изменений.
+Если процессоров меньше, чем потоков, писатель rcu ждет, пока вытесненный читатель
+снова получит процессор и закончит чтение, и число записей в секунду заметно падает.
+С write_us = 0 писатель brlock почти не отпускает флаг, и читатели голодают:
+замок отдает предпочтение писателю, а писатель без пауз - уже не "редкие изменения".
+
+Программа для каждого варианта запускает от 1 до max_readers читателей и фонового
+писателя, который раз в write_us микросекунд меняет состояние (0 - без пауз).
+Состояние - счетчик и контрольная копия ~value, которые писатель меняет с паузой
+между ними: если синхронизация сломана, читатели увидят несогласованную пару (torn).
+Для каждого прогона печатается строка CSV: сколько чтений в секунду всего и на одного
+читателя (при хорошем масштабировании второе не падает с ростом числа читателей),
+сколько записей успел сделать писатель и число несогласованных чтений.
+
+Компилируем:
+
+$ g++ -O2 -o rw_bench rw_bench.c -pthread
+
+$ ./rw_bench 4 500 1000
+sync,readers,reads_per_sec,reads_per_sec_per_reader,writes_per_sec,torn
+mutex,1,...
+...
+rcu,4,...
+
+Один вариант и привязка читателей к процессорам (cpu_affinity.h):
+
+$ ./rw_bench 8 500 1000 rcu --cpus 0-7
+*/
@@ -0,0 +1,285 @@
+#ifndef RW_SYNC_H
+#define RW_SYNC_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // sched_getcpu(), PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/membarrier.h>
+#include "ipc_common.h"
+
+//--- Синхронизация для данных, которые читают намного чаще, чем меняют.
+//--- Один интерфейс, четыре реализации (kind):
+//---     RW_SYNC_MUTEX  - один pthread_mutex_t на всех, как в mutex.c (для сравнения);
+//---     RW_SYNC_RWLOCK - pthread_rwlock_t: читатели не ждут друг друга, но каждый
+//---                      захват - атомарная операция над одним общим словом;
+//---     RW_SYNC_BRLOCK - "big-reader lock": у каждого процессора свой счетчик читателей
+//---                      в своей строке кэша, писатель проходит по всем;
+//---     RW_SYNC_RCU    - читатели без замков и атомарных операций: отмечают эпоху в своей
+//---                      ячейке и читают опубликованную версию; писатель готовит копию,
+//---                      публикует ее и ждет, пока старую версию никто не читает.
+//---
+//--- Читатель: rw_sync_reader() один раз на поток, затем rw_sync_read_lock()/read_unlock().
+//--- Писатель: rw_sync_write_lock() возвращает изменяемую версию, rw_sync_write_unlock()
+//--- публикует ее. Вложенные секции чтения не поддерживаются.
+
+#define RW_SYNC_MUTEX  0
+#define RW_SYNC_RWLOCK 1
+#define RW_SYNC_BRLOCK 2
+#define RW_SYNC_RCU    3
+#define RW_SYNC_KINDS  4
+
+#define RW_SYNC_SLOTS  64  // ячеек brlock и читателей RCU
+#define RW_SYNC_YIELD  128 // после стольких cpu_relax() ожидающий уступает процессор
+
+static const char *rw_sync_names[RW_SYNC_KINDS] = { "mutex", "rwlock", "brlock", "rcu" };
+
+//--- Ожидание, которое не мешает тому, кого ждем: на занятом процессоре он мог быть вытеснен
+static inline void rw_sync_pause(uint32_t *spins) {
+    if ( ++*spins % RW_SYNC_YIELD )
+        cpu_relax();
+    else
+        sched_yield();
+}
+
+//--- Big-reader lock. Читатель увеличивает счетчик своего процессора и проверяет флаг
+//--- писателя; писатель ставит флаг и ждет, пока обнулятся все счетчики. Обе стороны
+//--- сначала пишут свое, потом читают чужое (seq_cst), поэтому хотя бы одна увидит другую.
+//--- Строку с флагом писателя все читатели держат в кэше в разделяемом состоянии,
+//--- а свои счетчики - в монопольном: пока писателя нет, строки кэша не мигрируют.
+struct brlock_slot {
+    uint32_t readers;
+} CACHE_ALIGNED;
+
+struct brlock {
+    uint32_t writer CACHE_ALIGNED;
+    struct brlock_slot slots[RW_SYNC_SLOTS];
+};
+
+//--- Возвращает номер ячейки для brlock_read_unlock(): поток мог сменить процессор
+static inline int brlock_read_lock(struct brlock *l) {
+    int cpu = sched_getcpu();
+    int slot = (cpu < 0 ? 0 : cpu) % RW_SYNC_SLOTS;
+    struct brlock_slot *s = &l->slots[slot];
+    uint32_t spins = 0;
+
+    for ( ;; ) {
+        __atomic_fetch_add(&s->readers, 1, __ATOMIC_SEQ_CST);
+        if ( !__atomic_load_n(&l->writer, __ATOMIC_SEQ_CST) )
+            return slot;
+        //--- писатель уже ждет: уступаем ему, иначе поток читателей его не пропустит
+        __atomic_fetch_sub(&s->readers, 1, __ATOMIC_RELEASE);
+        while ( __atomic_load_n(&l->writer, __ATOMIC_RELAXED) )
+            rw_sync_pause(&spins);
+    }
+}
+
+static inline void brlock_read_unlock(struct brlock *l, int slot) {
+    __atomic_fetch_sub(&l->slots[slot].readers, 1, __ATOMIC_RELEASE);
+}
+
+static inline void brlock_write_lock(struct brlock *l) {
+    uint32_t expected, spins = 0;
+    int i;
+
+    for ( ;; ) {
+        expected = 0;
+        if ( __atomic_compare_exchange_n(&l->writer, &expected, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED) )
+            break;
+        rw_sync_pause(&spins);
+    }
+    for ( i = 0; i < RW_SYNC_SLOTS; i++ )
+        while ( __atomic_load_n(&l->slots[i].readers, __ATOMIC_SEQ_CST) )
+            rw_sync_pause(&spins);
+}
+
+static inline void brlock_write_unlock(struct brlock *l) {
+    __atomic_store_n(&l->writer, 0, __ATOMIC_RELEASE);
+}
+
+//--- Эпохи в стиле RCU. Читатель записывает в свою ячейку текущую эпоху (0 - вне секции
+//--- чтения), писатель после публикации новой версии увеличивает эпоху и ждет, пока
+//--- в каждой ячейке окажется 0 или новая эпоха: тогда старую версию уже никто не читает.
+//---
+//--- Запись эпохи читателем должна стать видна до чтения указателя на версию. Обычно
+//--- для этого нужен полный барьер (mfence) на каждое чтение. Если ядро поддерживает
+//--- membarrier(MEMBARRIER_CMD_PRIVATE_EXPEDITED), барьер на всех процессорах процесса
+//--- выполняет писатель одним системным вызовом, а читателю остается барьер компилятора.
+struct rcu_reader {
+    uint64_t epoch;
+} CACHE_ALIGNED;
+
+struct rcu_domain {
+    uint64_t          epoch CACHE_ALIGNED;
+    int               membarrier;
+    uint32_t          nreaders;
+    struct rcu_reader readers[RW_SYNC_SLOTS];
+};
+
+static inline void rcu_init(struct rcu_domain *d) {
+    d->epoch = 1;
+    d->nreaders = 0;
+    memset(d->readers, 0, sizeof(d->readers));
+    d->membarrier = syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0;
+}
+
+//--- Ячейка для нового потока-читателя или -1, если все заняты
+static inline int rcu_register(struct rcu_domain *d) {
+    uint32_t me = __atomic_fetch_add(&d->nreaders, 1, __ATOMIC_RELAXED);
+
+    if ( me >= RW_SYNC_SLOTS ) {
+        __atomic_fetch_sub(&d->nreaders, 1, __ATOMIC_RELAXED);
+        errno = EMFILE;
+        return -1;
+    }
+    return me;
+}
+
+static inline void rcu_read_lock(struct rcu_domain *d, int me) {
+    __atomic_store_n(&d->readers[me].epoch, __atomic_load_n(&d->epoch, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+    if ( d->membarrier )
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    else
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void rcu_read_unlock(struct rcu_domain *d, int me) {
+    __atomic_store_n(&d->readers[me].epoch, 0, __ATOMIC_RELEASE);
+}
+
+//--- Ждет, пока закончатся все секции чтения, начатые до вызова
+static inline void rcu_synchronize(struct rcu_domain *d) {
+    uint64_t now = __atomic_add_fetch(&d->epoch, 1, __ATOMIC_SEQ_CST), e;
+    uint32_t i, n = __atomic_load_n(&d->nreaders, __ATOMIC_ACQUIRE), spins = 0;
+
+    if ( n > RW_SYNC_SLOTS )
+        n = RW_SYNC_SLOTS;
+    if ( !d->membarrier || syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0) == -1 )
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for ( i = 0; i < n; i++ ) {
+        while ( (e = __atomic_load_n(&d->readers[i].epoch, __ATOMIC_ACQUIRE)) && e < now )
+            rw_sync_pause(&spins);
+    }
+}
+
+//--- Общий интерфейс
+struct rw_sync {
+    int              kind;
+    size_t           size;
+    void            *data[2]; // RCU: две версии по очереди, остальным нужна одна
+    void            *cur;     // опубликованная версия
+    pthread_mutex_t  mutex;   // RW_SYNC_MUTEX и писатели RCU
+    pthread_rwlock_t rwlock;
+    struct brlock    br;
+    struct rcu_domain rcu;
+};
+
+struct rw_reader {
+    int slot; // RCU - ячейка читателя, brlock - ячейка текущего захвата
+};
+
+static inline int rw_sync_init(struct rw_sync *s, int kind, const void *init, size_t size) {
+    pthread_rwlockattr_t attr;
+    int i;
+
+    memset(s, 0, sizeof(*s));
+    s->kind = kind;
+    s->size = size;
+    for ( i = 0; i < (kind == RW_SYNC_RCU ? 2 : 1); i++ ) {
+        if ( posix_memalign(&s->data[i], CACHE_LINE_SIZE, size) ) {
+            free(s->data[0]);
+            errno = ENOMEM;
+            return -1;
+        }
+        memcpy(s->data[i], init, size);
+    }
+    s->cur = s->data[0];
+    pthread_mutex_init(&s->mutex, NULL);
+    //--- по умолчанию glibc пропускает читателей вперед, и при постоянном потоке
+    //--- читателей писатель может не дождаться замка никогда
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&s->rwlock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+    rcu_init(&s->rcu);
+    return 0;
+}
+
+static inline void rw_sync_destroy(struct rw_sync *s) {
+    pthread_mutex_destroy(&s->mutex);
+    pthread_rwlock_destroy(&s->rwlock);
+    free(s->data[0]);
+    free(s->data[1]);
+    s->data[0] = s->data[1] = s->cur = NULL;
+}
+
+//--- Один раз в каждом потоке-читателе
+static inline int rw_sync_reader(struct rw_sync *s, struct rw_reader *r) {
+    r->slot = 0;
+    if ( s->kind == RW_SYNC_RCU && (r->slot = rcu_register(&s->rcu)) == -1 )
+        return -1;
+    return 0;
+}
+
+static inline const void *rw_sync_read_lock(struct rw_sync *s, struct rw_reader *r) {
+    switch ( s->kind ) {
+    case RW_SYNC_MUTEX:  pthread_mutex_lock(&s->mutex); break;
+    case RW_SYNC_RWLOCK: pthread_rwlock_rdlock(&s->rwlock); break;
+    case RW_SYNC_BRLOCK: r->slot = brlock_read_lock(&s->br); break;
+    case RW_SYNC_RCU:
+        rcu_read_lock(&s->rcu, r->slot);
+        return __atomic_load_n(&s->cur, __ATOMIC_ACQUIRE);
+    }
+    return s->cur;
+}
+
+static inline void rw_sync_read_unlock(struct rw_sync *s, struct rw_reader *r) {
+    switch ( s->kind ) {
+    case RW_SYNC_MUTEX:  pthread_mutex_unlock(&s->mutex); break;
+    case RW_SYNC_RWLOCK: pthread_rwlock_unlock(&s->rwlock); break;
+    case RW_SYNC_BRLOCK: brlock_read_unlock(&s->br, r->slot); break;
+    case RW_SYNC_RCU:    rcu_read_unlock(&s->rcu, r->slot); break;
+    }
+}
+
+//--- Изменяемая версия данных. У RCU это копия опубликованной: читатели ее не видят,
+//--- пока rw_sync_write_unlock() не опубликует ее.
+static inline void *rw_sync_write_lock(struct rw_sync *s) {
+    void *next;
+
+    switch ( s->kind ) {
+    case RW_SYNC_MUTEX:  pthread_mutex_lock(&s->mutex); break;
+    case RW_SYNC_RWLOCK: pthread_rwlock_wrlock(&s->rwlock); break;
+    case RW_SYNC_BRLOCK: brlock_write_lock(&s->br); break;
+    case RW_SYNC_RCU:
+        pthread_mutex_lock(&s->mutex);
+        next = s->cur == s->data[0] ? s->data[1] : s->data[0];
+        memcpy(next, s->cur, s->size);
+        return next;
+    }
+    return s->cur;
+}
+
+//--- У RCU возвращается после периода ожидания: прежнюю версию больше никто не читает,
+//--- и следующий rw_sync_write_lock() может писать в нее
+static inline void rw_sync_write_unlock(struct rw_sync *s) {
+    switch ( s->kind ) {
+    case RW_SYNC_MUTEX:  pthread_mutex_unlock(&s->mutex); break;
+    case RW_SYNC_RWLOCK: pthread_rwlock_unlock(&s->rwlock); break;
+    case RW_SYNC_BRLOCK: brlock_write_unlock(&s->br); break;
+    case RW_SYNC_RCU:
+        __atomic_store_n(&s->cur, s->cur == s->data[0] ? s->data[1] : s->data[0], __ATOMIC_RELEASE);
+        rcu_synchronize(&s->rcu);
+        pthread_mutex_unlock(&s->mutex);
+        break;
+    }
+}
+
+#endif
@@ -2,13 +2,31 @@
 #include <sys/stat.h>
 #include <semaphore.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "futex_wait.h"
 
 #define SEMAPHORE_NAME "/my_named_semaphore"
 
+//--- sem_trywait() не входит в ядро: на нем можно крутиться в режиме опроса
+static int sem_ready(void *sem) {
+    int err = errno, rc = sem_trywait((sem_t *)sem) == 0;
+
+    errno = err; // EAGAIN не должен попасть в perror() ниже
+    return rc;
+}
+
 int main(int argc, char ** argv) {
     sem_t *sem;
-
-    if ( argc == 2 ) {
+    struct shm_poll poll;
+    int polling = 0;
+
+    //--- ./sem_open poll spin_us [backoff_us] - ожидание в режиме опроса
+    if ( argc >= 3 && !strcmp(argv[1], "poll") ) {
+        shm_poll_init(&poll, strtoull(argv[2], NULL, 0) * 1000,
+                      argc >= 4 ? strtoull(argv[3], NULL, 0) * 1000 : SHM_POLL_BACKOFF_NS);
+        polling = 1;
+    } else if ( argc == 2 ) {
         printf("Dropping semaphore...\n");
         if ( (sem = sem_open(SEMAPHORE_NAME, 0)) == SEM_FAILED ) {
             perror("sem_open");
@@ -26,8 +44,14 @@ int main(int argc, char ** argv) {
     }
 
     printf("Semaphore is taken.\nWaiting for it to be dropped.\n");
-    sem_wait(sem);
-    perror("sem_wait");
+    if ( !polling || !shm_poll_wait(&poll, sem_ready, sem) ) {
+        if ( polling )
+            shm_poll_parked(&poll);
+        sem_wait(sem);
+        perror("sem_wait");
+    }
+    if ( polling )
+        shm_poll_report(&poll, "Semaphore");
     sem_close(sem);
     perror("sem_close");
 
@@ -156,5 +180,18 @@ $ ./sem_open 1
 Dropping semaphore...
 sem_post: Success
 Semaphore dropped.
+
+Режим опроса: ./sem_open poll spin_us [backoff_us]. sem_wait() на занятом семафоре сразу
+уходит в ядро (futex). Для ожидающего, которому важна задержка, сначала spin_us
+крутимся на sem_trywait() (это атомарная операция в пользовательском пространстве),
+затем еще backoff_us (по умолчанию 500) - с растущими паузами, и только потом
+вызываем sem_wait(). В конце печатается, на какой ступени семафор освободился
+(shm_poll_wait из futex_wait.h):
+
+$ ./sem_open poll 1000000
+Semaphore is taken.
+Waiting for it to be dropped.
+Semaphore waits: 0 ready, 1 spin, 0 backoff, 0 park (0.0% reached the kernel)
+sem_close: Success
 */
 
@@ -0,0 +1,57 @@
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <stdint.h>
+#include "ipc_common.h"
+
+//--- Seqlock: писатель увеличивает счетчик seq до и после изменения данных
+//--- (нечетное значение - идет запись), читатель копирует данные и повторяет
+//--- чтение, если seq за это время изменился. Читатели ничего не пишут в общую
+//--- память, поэтому не блокируют и не замедляют писателя и друг друга.
+
+struct seqlock {
+    uint32_t seq;
+};
+
+static inline void seqlock_init(struct seqlock *sl) {
+    sl->seq = 0;
+}
+
+//--- Начало записи. Писатели из разных процессов упорядочиваются здесь же:
+//--- перевести seq из четного в нечетное может только один.
+static inline void seqlock_write_begin(struct seqlock *sl) {
+    uint32_t seq = __atomic_load_n(&sl->seq, __ATOMIC_RELAXED);
+
+    for ( ;; ) {
+        if ( !(seq & 1) &&
+             __atomic_compare_exchange_n(&sl->seq, &seq, seq + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED) )
+            break;
+        cpu_relax();
+        seq = __atomic_load_n(&sl->seq, __ATOMIC_RELAXED);
+    }
+    //--- записи данных не должны обогнать нечетный seq
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void seqlock_write_end(struct seqlock *sl) {
+    __atomic_store_n(&sl->seq, __atomic_load_n(&sl->seq, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+}
+
+//--- Начало чтения: ждет окончания текущей записи и возвращает версию
+static inline uint32_t seqlock_read_begin(const struct seqlock *sl) {
+    uint32_t seq;
+
+    while ( (seq = __atomic_load_n(&sl->seq, __ATOMIC_ACQUIRE)) & 1 )
+        cpu_relax();
+    return seq;
+}
+
+//--- Конец чтения: ненулевое значение - данные могли быть изменены во время копирования,
+//--- копию надо выбросить и прочитать заново
+static inline int seqlock_read_retry(const struct seqlock *sl, uint32_t seq) {
+    //--- чтения данных не должны опоздать за повторное чтение seq
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&sl->seq, __ATOMIC_RELAXED) != seq;
+}
+
+#endif
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "sharded_counter.h"
+
+#define MAX_THREADS 64
+
+static struct sharded_counter counter; // shared resource
+static volatile int done;
+
+void *incr_counter(void *p) {
+    while ( !done )
+        sharded_counter_inc(&counter); // без мьютекса: каждый поток пишет в свою ячейку
+    return NULL;
+}
+
+void *reset_counter(void *p) {
+    char buf[32];
+
+    printf("Enter the number and press 'Enter' to initialize the counter with new value anytime.\n");
+    //--- Сброс не останавливает потоки incr_counter
+    while ( fgets(buf, sizeof(buf), stdin) == buf ) {
+        sharded_counter_reset(&counter, atoll(buf));
+        printf("New value for counter is %lld\n", (long long)sharded_counter_read(&counter));
+    }
+    done = 1;
+    return NULL;
+}
+
+int main(int argc, char ** argv) {
+    pthread_t threads[MAX_THREADS];
+    pthread_t thread_reset;
+    int i, nthreads = (argc == 2) ? atoi(argv[1]) : 4;
+    int64_t prev = 0, cur;
+
+    if ( nthreads < 1 || nthreads > MAX_THREADS ) {
+        printf("Usage: %s [threads 1..%d]\n", argv[0], MAX_THREADS);
+        return 1;
+    }
+    sharded_counter_init(&counter, 0);
+
+    for ( i = 0; i < nthreads; i++ )
+        pthread_create(&threads[i], NULL, incr_counter, NULL);
+    pthread_create(&thread_reset, NULL, reset_counter, NULL);
+
+    //--- Раз в секунду собираем значение из ячеек
+    while ( !done ) {
+        sleep(1);
+        cur = sharded_counter_read(&counter);
+        printf("%lld (%+lld/s)\n", (long long)cur, (long long)(cur - prev));
+        prev = cur;
+    }
+
+    for ( i = 0; i < nthreads; i++ )
+        pthread_join(threads[i], NULL);
+    pthread_join(thread_reset, NULL);
+    return 0;
+}
+
+/*
+Счетчик без общего мьютекса
+
+В mutex.c каждый вызов incr_counter() берет общий pthread_mutex_t ради counter++.
+Для счетчиков статистики, которые увеличивают многие потоки, это узкое место:
+все потоки стоят в очереди к одному мьютексу, а строка кэша с ним и со счетчиком
+постоянно переезжает между ядрами.
+
+Здесь (sharded_counter.h) у каждого потока своя ячейка в отдельной строке кэша,
+и увеличение - это одна атомарная операция с relaxed-порядком без какой-либо
+конкуренции. Чтение складывает все ячейки - это дороже, но читают счетчик редко.
+
+Сброс, как и reset_counter() в mutex.c, можно делать в любой момент, не останавливая
+потоки: он начинает новое поколение, и ячейки предыдущего поколения читатель
+просто не учитывает. Поэтому сброс происходит в одной точке (запись номера поколения),
+и не бывает так, что часть увеличений после сброса потерялась, а часть - нет.
+
+Компилируем:
+
+$ g++ -o sharded_counter sharded_counter.c -pthread
+
+$ ./sharded_counter 8
+Enter the number and press 'Enter' to initialize the counter with new value anytime.
+181234567 (+181234567/s)
+362811023 (+181576456/s)
+30 <Enter>     <--- новое значение переменной
+New value for counter is 30
+181001230 (-181809793/s)
+*/
@@ -0,0 +1,117 @@
+#ifndef SHARDED_COUNTER_H
+#define SHARDED_COUNTER_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "ipc_common.h"
+
+//--- Счетчик, разделенный на ячейки (shards): каждый поток увеличивает свою ячейку,
+//--- которая лежит в отдельной строке кэша, атомарной операцией с relaxed-порядком.
+//--- Значение счетчика собирается из ячеек только при чтении.
+//---
+//--- Сброс не останавливает писателей. Каждый сброс начинает новое поколение gen,
+//--- а в ячейке вместе со значением хранится поколение, в котором ее увеличивали:
+//---     старшие 16 бит - поколение, младшие 48 бит - число увеличений.
+//--- Читатель суммирует только ячейки текущего поколения, поэтому сброс вступает
+//--- в силу в один момент - при записи gen - и ни одно более позднее увеличение не теряется.
+
+#define SHARDED_COUNTER_SLOTS      64
+#define SHARDED_COUNTER_COUNT_BITS 48
+#define SHARDED_COUNTER_COUNT_MASK ((1ull << SHARDED_COUNTER_COUNT_BITS) - 1)
+//--- Поколение в ячейке хранится по модулю 65536: ячейку, которую не трогали ровно
+//--- 65536 сбросов подряд, читатель примет за текущую. Для счетчиков статистики это приемлемо.
+#define SHARDED_COUNTER_EPOCH(v)   ((uint16_t)((v) >> SHARDED_COUNTER_COUNT_BITS))
+
+struct sharded_counter_slot {
+    uint64_t val;
+} CACHE_ALIGNED;
+
+struct sharded_counter {
+    uint64_t        gen CACHE_ALIGNED; // номер поколения, растет при каждом сбросе
+    int64_t         base[2];           // значение после сброса; индекс - четность gen
+    pthread_mutex_t reset_lock;        // сбросы редки, их упорядочиваем мьютексом
+    struct sharded_counter_slot slots[SHARDED_COUNTER_SLOTS];
+};
+
+static uint32_t     sharded_counter_next_slot;
+static __thread int sharded_counter_my_slot = -1;
+
+static inline void sharded_counter_init(struct sharded_counter *c, int64_t value) {
+    int i;
+
+    c->gen = 0;
+    c->base[0] = value;
+    c->base[1] = 0;
+    pthread_mutex_init(&c->reset_lock, NULL);
+    for ( i = 0; i < SHARDED_COUNTER_SLOTS; i++ )
+        c->slots[i].val = 0;
+}
+
+//--- Ячейка текущего потока. Если потоков больше, чем ячеек, ячейки делятся,
+//--- что остается корректным, так как все изменения ячеек атомарны.
+//--- Номер ячейки у потока один для всех счетчиков.
+static inline struct sharded_counter_slot *sharded_counter_slot(struct sharded_counter *c) {
+    if ( sharded_counter_my_slot < 0 )
+        sharded_counter_my_slot = __atomic_fetch_add(&sharded_counter_next_slot, 1, __ATOMIC_RELAXED) % SHARDED_COUNTER_SLOTS;
+    return &c->slots[sharded_counter_my_slot];
+}
+
+static inline void sharded_counter_add(struct sharded_counter *c, uint64_t n) {
+    struct sharded_counter_slot *s = sharded_counter_slot(c);
+    uint16_t epoch = (uint16_t)__atomic_load_n(&c->gen, __ATOMIC_ACQUIRE);
+    uint64_t v = __atomic_load_n(&s->val, __ATOMIC_RELAXED);
+
+    for ( ;; ) {
+        if ( SHARDED_COUNTER_EPOCH(v) == epoch ) {
+            //--- обычный путь: поколение совпадает, просто прибавляем
+            __atomic_fetch_add(&s->val, n, __ATOMIC_RELAXED);
+            return;
+        }
+        if ( (int16_t)(SHARDED_COUNTER_EPOCH(v) - epoch) > 0 ) {
+            //--- ячейку уже перевел в новое поколение сосед по ячейке: сброс произошел
+            //--- во время нашей операции, перечитываем gen
+            epoch = (uint16_t)__atomic_load_n(&c->gen, __ATOMIC_ACQUIRE);
+            continue;
+        }
+        //--- первое увеличение ячейки после сброса: старое значение отбрасываем
+        if ( __atomic_compare_exchange_n(&s->val, &v, ((uint64_t)epoch << SHARDED_COUNTER_COUNT_BITS) | n, 0,
+                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED) )
+            return;
+    }
+}
+
+static inline void sharded_counter_inc(struct sharded_counter *c) {
+    sharded_counter_add(c, 1);
+}
+
+//--- Сумма ячеек текущего поколения. Если во время обхода произошел сброс - повторяем.
+static inline int64_t sharded_counter_read(const struct sharded_counter *c) {
+    uint64_t gen, v;
+    int64_t sum;
+    int i;
+
+    do {
+        gen = __atomic_load_n(&c->gen, __ATOMIC_ACQUIRE);
+        sum = __atomic_load_n(&c->base[gen & 1], __ATOMIC_RELAXED);
+        for ( i = 0; i < SHARDED_COUNTER_SLOTS; i++ ) {
+            v = __atomic_load_n(&c->slots[i].val, __ATOMIC_RELAXED);
+            if ( SHARDED_COUNTER_EPOCH(v) == (uint16_t)gen )
+                sum += v & SHARDED_COUNTER_COUNT_MASK;
+        }
+    } while ( __atomic_load_n(&c->gen, __ATOMIC_ACQUIRE) != gen );
+    return sum;
+}
+
+//--- Сброс в value. Точка линеаризации - запись нового gen: все увеличения,
+//--- начавшиеся до нее, считаются выполненными до сброса.
+static inline void sharded_counter_reset(struct sharded_counter *c, int64_t value) {
+    uint64_t gen;
+
+    pthread_mutex_lock(&c->reset_lock);
+    gen = __atomic_load_n(&c->gen, __ATOMIC_RELAXED) + 1;
+    __atomic_store_n(&c->base[gen & 1], value, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->gen, gen, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&c->reset_lock);
+}
+
+#endif
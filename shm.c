@@ -4,21 +4,169 @@
 #include <sys/stat.h> /* For mode constants */
 #include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
+#include "shm_segment.h"
+#include "seqlock.h"
+#include "shm_ckpt.h"
+#include "triple_buf.h"
+#include "locks.h"
 
 #define SHARED_MEMORY_OBJECT_NAME "my_shared_memory"
 #define SHARED_MEMORY_OBJECT_SIZE 50
 #define SHM_CREATE 1
 #define SHM_PRINT  3
 #define SHM_CLOSE  4
+#define SHM_WATCH  5
+#define SHM_CHECKPOINT 6
+#define SHM_RESTORE    7
+
+//--- Так выглядит разделяемая память: строка, защищенная seqlock.
+//--- Строка занимает весь остаток сегмента, размер сегмента задается при создании.
+struct shm_object {
+    struct seqlock lock;
+    int            len;
+    char           data[];
+};
+
+//--- Размер сегмента по умолчанию - как раньше, под строку из SHARED_MEMORY_OBJECT_SIZE символов
+#define SHM_OBJECT_DEFAULT_SIZE (offsetof(struct shm_object, data) + SHARED_MEMORY_OBJECT_SIZE + 1)
+
+//--- С --triple сегмент размечен под тройной буфер (triple_buf.h): строка пишется
+//--- в задний слот и публикуется целиком, читатель берет последнюю без повторов.
+struct shm_triple {
+    struct ttas_lock  writer; // писатели из разных процессов публикуют по очереди
+    struct triple_buf tb;
+};
+
+struct shm_triple_slot {
+    uint64_t version;
+    int      len;
+    char     data[];
+};
+
+//--- Наименьший сегмент для --triple: слоты по строке кэша
+#define SHM_TRIPLE_MIN_SIZE (sizeof(struct shm_triple) + 3 * CACHE_LINE_SIZE)
 
 void usage(const char * s) {
-    printf("Usage: %s <create|write|read|unlink> ['text']\n", s);
+    printf("Usage: %s <create|write|print|watch|unlink> ['text'] [options]\n", s);
+    printf("       %s <checkpoint|restore> file [--hugetlb]\n", s);
+    printf("all commands accept --triple to use the segment as a triple buffer\n");
+    printf("create options: --size N[K|M|G] --populate --willneed --mlock --thp --hugetlb\n");
+    printf("other commands accept --hugetlb to find a hugetlbfs segment\n");
+}
+
+//--- Вместимость строки в сегменте размера size
+static size_t shm_object_capacity(size_t size) {
+    return size > offsetof(struct shm_object, data) ? size - offsetof(struct shm_object, data) - 1 : 0;
+}
+
+//--- Разбор размера вида 4096, 64K, 16M, 1G
+static int parse_size(const char *s, size_t *size) {
+    char *end;
+    unsigned long long v = strtoull(s, &end, 10);
+
+    switch ( *end ) {
+    case 'G': case 'g': v <<= 10; /* fallthrough */
+    case 'M': case 'm': v <<= 10; /* fallthrough */
+    case 'K': case 'k': v <<= 10; end++; break;
+    }
+    if ( end == s || *end != '\0' || v == 0 )
+        return -1;
+    *size = v;
+    return 0;
+}
+
+//--- Согласованная копия строки: повторяем, пока писатель не оставит ее в покое
+int shm_object_read(const struct shm_object *obj, size_t capacity, char *buf, uint32_t *version) {
+    uint32_t seq;
+    int len;
+
+    do {
+        seq = seqlock_read_begin(&obj->lock);
+        len = obj->len;
+        if ( len < 0 || (size_t)len > capacity )
+            len = 0; // мусор из недописанной версии, seqlock_read_retry() его отбросит
+        memcpy(buf, obj->data, len);
+    } while ( seqlock_read_retry(&obj->lock, seq) );
+    buf[len] = '\0';
+    if ( version )
+        *version = seq;
+    return len;
+}
+
+//--- Команды в режиме --triple. Писатель собирает строку прямо в заднем слоте,
+//--- читатель (print или watch - один в каждый момент) печатает ее прямо из переднего.
+int run_triple(int cmd, struct shm_triple *obj, size_t size, const char *text, struct shm_ckpt *ckpt) {
+    struct triple_buf *tb = &obj->tb;
+    struct shm_triple_slot *slot;
+    size_t capacity;
+    long pages;
+    int len;
+
+    if ( !triple_buf_valid(tb, size - offsetof(struct shm_triple, tb)) ) {
+        if ( cmd != SHM_CREATE ) {
+            printf("Shared memory is not a triple buffer, run 'create --triple' first\n");
+            return 1;
+        }
+        obj->writer.locked = 0; // на этом месте мог быть счетчик seqlock
+        triple_buf_init(tb, size - offsetof(struct shm_triple, tb));
+    }
+    capacity = tb->slot_size - offsetof(struct shm_triple_slot, data) - 1;
+
+    switch ( cmd ) {
+    case SHM_CREATE:
+        ttas_lock(&obj->writer);
+        slot = (struct shm_triple_slot *)triple_buf_back(tb);
+        len = strlen(text) <= capacity ? (int)strlen(text) : (int)capacity;
+        memcpy(slot->data, text, len);
+        slot->data[len] = '\0';
+        slot->len = len;
+        slot->version = tb->published + 1;
+        shm_ckpt_mark(ckpt, slot, offsetof(struct shm_triple_slot, data) + len + 1);
+        triple_buf_publish(tb);
+        shm_ckpt_mark(ckpt, obj, sizeof(*obj));
+        ttas_unlock(&obj->writer);
+        printf("Shared memory filled in. You may run 'print --triple' to see shared memory value.\n");
+        break;
+    case SHM_PRINT:
+        triple_buf_update(tb);
+        slot = (struct shm_triple_slot *)triple_buf_front(tb);
+        printf("Got from shared memory: %.*s\n", slot->len, slot->data);
+        break;
+    case SHM_CHECKPOINT:
+        //--- повторять не нужно: опубликованные слоты писатель не трогает,
+        //--- а недописанный задний слот после восстановления перепишет следующая запись
+        if ( (pages = shm_ckpt_save(ckpt, text)) == -1 )
+            return 1;
+        printf("Checkpoint: %ld of %zu pages written to %s\n", pages, (size + ckpt->page_size - 1) / ckpt->page_size, text);
+        break;
+    case SHM_WATCH:
+        //--- один обмен номера слота, если есть новое значение, и ни одного копирования
+        for ( ;; ) {
+            if ( triple_buf_update(tb) ) {
+                slot = (struct shm_triple_slot *)triple_buf_front(tb);
+                printf("Got from shared memory (version %llu): %.*s\n", (unsigned long long)slot->version, slot->len, slot->data);
+                fflush(stdout);
+            }
+            usleep(1000);
+        }
+        break;
+    }
+    return 0;
 }
 
 int main (int argc, char ** argv) {
-    int shm, len, cmd, mode = 0;
-    char *addr;
+    int i, len = 0, cmd, flags = 0, triple = 0, rc;
+    struct shm_object *addr;
+    struct shm_ckpt ckpt;
+    long pages;
+    const char *text = NULL;
+    char *buf;
+    size_t size = SHM_OBJECT_DEFAULT_SIZE, capacity;
+    uint32_t version, seen = 1; // нечетная версия никогда не будет прочитана
+    uint64_t t0;
 
     //--- разбор командной строки
     if ( argc < 2 ) {
@@ -26,63 +174,153 @@ int main (int argc, char ** argv) {
         return 1;
     }
 
-    if ( (!strcmp(argv[1], "create") || !strcmp(argv[1], "write")) && (argc == 3) ) {
-        len = strlen(argv[2]);
-        len = (len<=SHARED_MEMORY_OBJECT_SIZE)?len:SHARED_MEMORY_OBJECT_SIZE;
-        mode = O_CREAT;
+    for ( i = 2; i < argc; i++ ) {
+        if ( ! strcmp(argv[i], "--size") && i + 1 < argc ) {
+            if ( parse_size(argv[++i], &size) == -1 || size < SHM_OBJECT_DEFAULT_SIZE ) {
+                fprintf(stderr, "bad size: %s\n", argv[i]);
+                return 1;
+            }
+        } else if ( ! strcmp(argv[i], "--populate") ) {
+            flags |= SHM_SEG_POPULATE;
+        } else if ( ! strcmp(argv[i], "--willneed") ) {
+            flags |= SHM_SEG_WILLNEED;
+        } else if ( ! strcmp(argv[i], "--mlock") ) {
+            flags |= SHM_SEG_MLOCK;
+        } else if ( ! strcmp(argv[i], "--thp") ) {
+            flags |= SHM_SEG_THP;
+        } else if ( ! strcmp(argv[i], "--hugetlb") ) {
+            flags |= SHM_SEG_HUGETLB;
+        } else if ( ! strcmp(argv[i], "--triple") ) {
+            triple = 1;
+        } else if ( ! text && strncmp(argv[i], "--", 2) ) {
+            text = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if ( (!strcmp(argv[1], "create") || !strcmp(argv[1], "write")) && text ) {
+        len = strlen(text);
         cmd = SHM_CREATE;
-    } else if ( ! strcmp(argv[1], "print" ) ) {
+    } else if ( ! strcmp(argv[1], "print" ) && ! text ) {
         cmd = SHM_PRINT;
-    } else if ( ! strcmp(argv[1], "unlink" ) ) {
+    } else if ( ! strcmp(argv[1], "watch" ) && ! text ) {
+        cmd = SHM_WATCH;
+    } else if ( ! strcmp(argv[1], "unlink" ) && ! text ) {
         cmd = SHM_CLOSE;
+    } else if ( ! strcmp(argv[1], "checkpoint" ) && text ) {
+        cmd = SHM_CHECKPOINT;
+    } else if ( ! strcmp(argv[1], "restore" ) && text ) {
+        cmd = SHM_RESTORE;
     } else {
         usage(argv[0]);
         return 1;
     }
 
-    //--- Создает дескриптор разделяемой памяти с именем SHARED_MEMORY_OBJECT_NAME с режимом O_RDWR и ключами
-    if ( (shm = shm_open(SHARED_MEMORY_OBJECT_NAME, mode|O_RDWR, S_IRWXO|S_IRWXG|S_IRWXU)) == -1 ) {
-        perror("shm_open");
-        return 1;
+    if ( cmd == SHM_CLOSE ) {
+        if ( shm_segment_unlink(SHARED_MEMORY_OBJECT_NAME, flags) == -1 ) {
+            perror("shm_unlink");
+            return 1;
+        }
+        shm_ckpt_unlink(SHARED_MEMORY_OBJECT_NAME); // карты изменений может и не быть
+        return 0;
     }
 
-    //--- Создает буфер в памяти с именем SHARED_MEMORY_OBJECT_NAME = "my_shared_memory" 
-	//--- размера SHARED_MEMORY_OBJECT_SIZE
-    if ( cmd == SHM_CREATE ) {
-        if ( ftruncate(shm, SHARED_MEMORY_OBJECT_SIZE+1) == -1 ) {
-            perror("ftruncate");
+    if ( cmd == SHM_RESTORE ) {
+        //--- сегмент целиком из снимка; все страницы совпадают с файлом, отметки снимаются
+        t0 = now_ns();
+        if ( (addr = (struct shm_object *)shm_ckpt_restore(SHARED_MEMORY_OBJECT_NAME, text, &size, flags)) == NULL ||
+             shm_ckpt_attach(&ckpt, SHARED_MEMORY_OBJECT_NAME, addr, size) == -1 )
             return 1;
-        }
+        shm_ckpt_clear(&ckpt);
+        printf("Restored %zu bytes from %s in %.3f ms\n", size, text, (now_ns() - t0) / 1e6);
+        shm_ckpt_detach(&ckpt);
+        shm_segment_close(addr, size);
+        return 0;
     }
 
-    //--- type addr -> char* - Это адрес начала строка в памяти shared memory, которая создана функцией create
-    if ( (addr = (char*)mmap(0, SHARED_MEMORY_OBJECT_SIZE+1, PROT_WRITE|PROT_READ, MAP_SHARED, shm, 0)) == (char*)-1 ) {
-        perror("mmap");
+    if ( triple && size < SHM_TRIPLE_MIN_SIZE )
+        size = SHM_TRIPLE_MIN_SIZE;
+
+    //--- Создает (create) или открывает разделяемую память с именем SHARED_MEMORY_OBJECT_NAME = "my_shared_memory".
+    //--- Новый объект заполнен нулями, т.е. seqlock уже инициализирован.
+    //--- Остальные команды узнают размер сегмента у самого объекта.
+    t0 = now_ns();
+    if ( (addr = (struct shm_object*)shm_segment_map(SHARED_MEMORY_OBJECT_NAME, &size, cmd == SHM_CREATE, flags)) == NULL )
+        return 1;
+    printf("addr = %p, size = %zu, mapped in %.3f ms\n", (void *)addr, size, (now_ns() - t0) / 1e6);
+    //--- писатель и снимок работают с картой измененных страниц
+    if ( (cmd == SHM_CREATE || cmd == SHM_CHECKPOINT) &&
+         shm_ckpt_attach(&ckpt, SHARED_MEMORY_OBJECT_NAME, addr, size) == -1 )
         return 1;
-    }else{
-		printf("addr = %s\n", addr);
-	}
 
-    
+    if ( triple ) {
+        rc = run_triple(cmd, (struct shm_triple *)addr, size, text, &ckpt);
+        if ( cmd == SHM_CREATE || cmd == SHM_CHECKPOINT )
+            shm_ckpt_detach(&ckpt);
+        shm_segment_close(addr, size);
+        return rc;
+    }
+
+    //--- обычные команды не должны портить тройной буфер, а он - их строку
+    if ( size >= SHM_TRIPLE_MIN_SIZE && triple_buf_valid(&((struct shm_triple *)addr)->tb, size - offsetof(struct shm_triple, tb)) ) {
+        printf("Shared memory is a triple buffer, use --triple\n");
+        return 1;
+    }
+
+    capacity = shm_object_capacity(size);
+    if ( (buf = (char *)malloc(capacity + 1)) == NULL ) {
+        perror("malloc");
+        return 1;
+    }
+
     switch ( cmd ) {
     case SHM_CREATE:
-        memcpy(addr, argv[2], len);
-        addr[len] = '\0';
+        len = ((size_t)len <= capacity) ? len : (int)capacity;
+        //--- читатели увидят либо старую строку, либо новую, но не половину новой
+        seqlock_write_begin(&addr->lock);
+        memcpy(addr->data, text, len);
+        addr->data[len] = '\0';
+        addr->len = len;
+        shm_ckpt_mark(&ckpt, addr, offsetof(struct shm_object, data) + len + 1);
+        seqlock_write_end(&addr->lock);
         printf("Shared memory filled in. You may run '%s print' to see shared memory value.\n", argv[0]);
         break;
     case SHM_PRINT:
-        printf("Got from shared memory: %s\n", addr);
+        shm_object_read(addr, capacity, buf, NULL);
+        printf("Got from shared memory: %s\n", buf);
+        break;
+    case SHM_CHECKPOINT:
+        //--- как читатель seqlock: если во время снимка строку меняли, писатель отметил
+        //--- свои страницы снова, и следующий проход допишет только их
+        t0 = now_ns();
+        do {
+            version = seqlock_read_begin(&addr->lock);
+            if ( (pages = shm_ckpt_save(&ckpt, text)) == -1 )
+                return 1;
+            printf("Checkpoint: %ld of %zu pages written to %s\n", pages, (size + ckpt.page_size - 1) / ckpt.page_size, text);
+        } while ( seqlock_read_retry(&addr->lock, version) );
+        printf("Checkpoint done in %.3f ms\n", (now_ns() - t0) / 1e6);
+        break;
+    case SHM_WATCH:
+        //--- читатель-монитор: ничего не пишет в разделяемую память и не мешает писателю
+        for ( ;; ) {
+            shm_object_read(addr, capacity, buf, &version);
+            if ( version != seen ) {
+                printf("Got from shared memory (version %u): %s\n", version / 2, buf);
+                fflush(stdout);
+                seen = version;
+            }
+            usleep(1000);
+        }
         break;
     }
 
-
-    munmap(addr, SHARED_MEMORY_OBJECT_SIZE);
-    close(shm);
-
-    if ( cmd == SHM_CLOSE ) {
-        shm_unlink(SHARED_MEMORY_OBJECT_NAME);
-    }
-
+    free(buf);
+    if ( cmd == SHM_CREATE || cmd == SHM_CHECKPOINT )
+        shm_ckpt_detach(&ckpt);
+    shm_segment_close(addr, size);
     return 0;
 }
 
@@ -240,4 +478,128 @@ shm_open: No such file or directory
 Но стоит нам вызвать shm_unlink(), 
 как память перестает быть нам доступна и shm_open() без параметра O_CREATE 
 возвращает ошибку «No such file or directory».
+
+Seqlock
+
+Команда print раньше читала строку без всякой синхронизации и могла увидеть
+половину новой строки, пока create ее записывает. Теперь строка лежит в struct shm_object
+вместе со счетчиком seq (seqlock.h):
+
+    писатель: seq++ (нечетный - идет запись) -> запись строки -> seq++ (снова четный)
+    читатель: запомнить seq -> скопировать строку -> если seq нечетный или изменился, повторить
+
+Читатели ничего не пишут в разделяемую память, поэтому сколько угодно процессов-мониторов
+могут читать последнюю версию с полной скоростью, не блокируя писателя и не замедляя его.
+
+$ ./shm create 'Hello!'
+$ ./shm watch
+Got from shared memory (version 1): Hello!
+Got from shared memory (version 2): Hello, my shared memory!    <-- после './shm create ...' в другой консоли
+
+Размер сегмента, предварительные страничные ошибки и большие страницы
+
+Строка больше не ограничена 50 символами: размер сегмента задается при создании,
+строка занимает все, что осталось после заголовка. Сегмент открывает shm_segment_map()
+(shm_segment.h), а опции команды create управляют тем, как он отображается:
+
+    --size N[K|M|G]  размер сегмента (по умолчанию - как раньше, под 50 символов)
+    --populate       MAP_POPULATE: ядро выделяет все страницы прямо в mmap(),
+                     первое обращение к странице больше не вызывает page fault
+    --willneed       madvise(MADV_WILLNEED): то же в виде подсказки, страницы подгружаются заранее
+    --mlock          mlock(): страницы закреплены в памяти и не вытесняются в swap
+                     (нужен RLIMIT_MEMLOCK не меньше размера сегмента или CAP_IPC_LOCK)
+    --thp            madvise(MADV_HUGEPAGE): прозрачные большие страницы 2 МБ; для /dev/shm
+                     работает, если /sys/kernel/mm/transparent_hugepage/shmem_enabled = advise
+    --hugetlb        явные большие страницы: сегмент - файл на hugetlbfs (/dev/hugepages),
+                     размер округляется до большой страницы. MAP_HUGETLB к объекту из /dev/shm
+                     не применить, поэтому для разделяемой памяти нужна именно hugetlbfs.
+
+Большая страница закрывает 2 МБ одной записью в TLB вместо 512, поэтому при проходе
+по большому буферу почти исчезают промахи TLB, а вместе с --populate - и страничные ошибки
+при первом касании. Пул больших страниц надо выделить заранее:
+
+# echo 512 > /proc/sys/vm/nr_hugepages
+# mount -t hugetlbfs none /dev/hugepages
+
+Остальным командам размер указывать не нужно - он берется у объекта (fstat),
+а --hugetlb подсказывает, где искать объект. Повторный create без --size сохраняет
+размер существующего сегмента - сегмент только растет, но не уменьшается:
+
+$ ./shm create 'Hello!' --size 64M --populate --mlock
+addr = 0x7f2b4c000000, size = 67108864, mapped in 11.482 ms
+Shared memory filled in. You may run './shm print' to see shared memory value.
+$ ./shm print
+addr = 0x7f4a1c000000, size = 67108864, mapped in 0.012 ms
+Got from shared memory: Hello!
+$ ./shm create 'Hello!' --size 1G --hugetlb --populate
+$ ./shm print --hugetlb
+$ ./shm unlink --hugetlb
+
+Снимок на диск
+
+Сегмент переживает завершение процессов, но не перезагрузку. Копировать в файл
+весь многогигабайтный сегмент на каждый снимок долго, поэтому снимок инкрементальный
+(shm_ckpt.h): писатель после изменения отмечает затронутые страницы в битовой карте
+- отдельном сегменте my_shared_memory.dirty, - а checkpoint пишет в файл только
+отмеченные страницы и снимает отметки.
+
+Биты soft-dirty (/proc/pid/clear_refs) или userfaultfd тут не подходят: они следят
+за таблицами страниц одного процесса, а писать в разделяемую память может любой.
+Карта в самой разделяемой памяти видит всех писателей, а отметка уже отмеченной
+страницы стоит одного чтения.
+
+Строку защищает seqlock, поэтому checkpoint ведет себя как читатель: если во время
+снимка была запись, проход повторяется, и дописываются только страницы, отмеченные заново.
+Заголовок файла помечается "снимок пишется" до записи страниц и "готово" - после
+fdatasync(), так что прерванный снимок restore не примет.
+
+$ ./shm create 'Hello!' --size 1G
+$ ./shm checkpoint /var/tmp/shm.ckpt
+Checkpoint: 262144 of 262144 pages written to /var/tmp/shm.ckpt   <-- первый снимок полный
+$ ./shm write 'Hello, my shared memory!'
+$ ./shm checkpoint /var/tmp/shm.ckpt
+Checkpoint: 1 of 262144 pages written to /var/tmp/shm.ckpt
+
+Если сегмент увеличить (create с большим --size), карта изменений растет вместе с ним,
+а новые страницы сразу отмечены измененными:
+
+$ ./shm create 'Hello!'
+$ ./shm checkpoint /var/tmp/small.ckpt
+Checkpoint: 1 of 1 pages written to /var/tmp/small.ckpt
+$ ./shm create 'World' --size 1M
+$ ./shm checkpoint /var/tmp/small.ckpt
+Checkpoint: 256 of 256 pages written to /var/tmp/small.ckpt   <-- размер другой, снимок полный
+
+После перезагрузки restore отображает файл через mmap() и копирует в новый сегмент
+только ненулевые страницы:
+
+$ ./shm restore /var/tmp/shm.ckpt
+Restored 1073741824 bytes from /var/tmp/shm.ckpt in 95.412 ms
+$ ./shm print
+Got from shared memory: Hello, my shared memory!
+
+Тройной буфер
+
+Читателю-монитору часто нужна только последняя версия, а не каждое изменение.
+С seqlock он копирует строку и повторяет копирование, если писатель успел ее поменять,
+- для большого объекта это дорого. С ключом --triple сегмент размечен под тройной
+буфер (triple_buf.h): три слота, задний принадлежит писателю, передний - читателю,
+средний хранит последнюю опубликованную версию.
+
+    писатель: собрать строку в заднем слоте -> обменять задний со средним (отметка "новое")
+    читатель: если есть отметка "новое" - обменять передний со средним -> читать передний
+
+Каждый обмен - одна атомарная операция со словом состояния. Писатель всегда имеет
+свободный слот и никого не ждет, читатель не повторяет чтение и работает прямо
+со слотом, без копирования. Версии, которые читатель не успел взять, пропадают.
+
+Читатель у тройного буфера один: передний слот принадлежит тому, кто его взял,
+поэтому print --triple и watch --triple не запускаются одновременно. Мониторов
+может быть сколько угодно только в режиме seqlock. Писатели из разных процессов
+публикуют по очереди под замком ttas_lock, читателя этот замок не касается.
+
+$ ./shm create 'Hello!' --triple
+$ ./shm watch --triple
+Got from shared memory (version 1): Hello!
+Got from shared memory (version 2): Hello, my shared memory!    <-- после './shm write ... --triple'
 */
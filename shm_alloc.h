@@ -0,0 +1,207 @@
+#ifndef SHM_ALLOC_H
+#define SHM_ALLOC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "ipc_common.h"
+
+//--- Распределитель памяти внутри сегмента разделяемой памяти.
+//--- Сегмент разбит на слэбы по SHM_ALLOC_SLAB байт, каждый слэб отдан одному классу
+//--- размеров (16, 32, ... SHM_ALLOC_MAX байт) и нарезан на блоки этого размера.
+//--- Свободные блоки лежат в lock-free списках: у каждой арены свой список на каждый класс.
+//---
+//--- Вместо указателей везде хранится смещение от начала сегмента (shm_off_t),
+//--- поэтому каждый процесс может отобразить сегмент по своему адресу.
+//--- Смещение 0 - это заголовок, как указатель оно означает NULL.
+
+typedef uint64_t shm_off_t;
+
+#define SHM_ALLOC_MAGIC    0x534c4142 // "SLAB"
+#define SHM_ALLOC_SLAB     (64 * 1024)
+#define SHM_ALLOC_MIN      16
+#define SHM_ALLOC_CLASSES  12         // 16 << 11 = 32 КБ
+#define SHM_ALLOC_MAX      (SHM_ALLOC_MIN << (SHM_ALLOC_CLASSES - 1))
+#define SHM_ALLOC_ARENAS   8
+#define SHM_ALLOC_SIZE_MAX ((uint64_t)SHM_ALLOC_MIN << 32) // смещения блоков в 32 битах, в единицах по 16 байт
+
+//--- Голова списка свободных блоков: в старших 32 битах счетчик изменений (защита от ABA),
+//--- в младших - смещение первого блока / SHM_ALLOC_MIN.
+#define SHM_ALLOC_HEAD(tag, off) (((uint64_t)(tag) << 32) | (uint32_t)((off) / SHM_ALLOC_MIN))
+#define SHM_ALLOC_HEAD_OFF(h)    ((shm_off_t)(uint32_t)(h) * SHM_ALLOC_MIN)
+#define SHM_ALLOC_HEAD_TAG(h)    ((uint32_t)((h) >> 32))
+
+struct shm_alloc_arena {
+    uint64_t free[SHM_ALLOC_CLASSES];
+} CACHE_ALIGNED;
+
+//--- Кому отдан слэб: класс размеров и арена. 0xff - слэб еще не выдан.
+struct shm_alloc_slab {
+    uint8_t cls;
+    uint8_t arena;
+};
+
+struct shm_alloc_hdr {
+    uint32_t  magic;
+    uint32_t  nslabs;
+    uint64_t  size;
+    shm_off_t root;                // корневой объект пользователя, с него процессы находят данные
+    uint32_t  next_arena;          // раздача арен потокам по кругу
+    uint32_t  top CACHE_ALIGNED;   // номер следующего еще не нарезанного слэба
+    struct shm_alloc_arena arenas[SHM_ALLOC_ARENAS];
+    struct shm_alloc_slab  slabs[];
+};
+
+//--- Локальная для процесса ручка: адрес, по которому сегмент отображен у нас
+struct shm_alloc {
+    struct shm_alloc_hdr *hdr;
+    char                 *base;
+};
+
+//--- Арена текущего потока (номер + 1, 0 - еще не выбрана)
+static __thread unsigned shm_alloc_my_arena;
+
+static inline void *shm_ptr(const struct shm_alloc *a, shm_off_t off) {
+    return off ? a->base + off : NULL;
+}
+
+static inline shm_off_t shm_off(const struct shm_alloc *a, const void *p) {
+    return p ? (shm_off_t)((const char *)p - a->base) : 0;
+}
+
+static inline int shm_alloc_class(size_t size) {
+    int cls = 0;
+
+    if ( size > SHM_ALLOC_MAX )
+        return -1;
+    while ( ((size_t)SHM_ALLOC_MIN << cls) < size )
+        cls++;
+    return cls;
+}
+
+//--- Разметка свежей памяти. Вызывается один раз создателем сегмента.
+//--- Заголовок с таблицей слэбов занимает первые слэбы, остальные раздаются по мере надобности.
+static inline int shm_alloc_init(void *mem, size_t size) {
+    struct shm_alloc_hdr *hdr = (struct shm_alloc_hdr *)mem;
+    uint32_t nslabs, first;
+
+    if ( size > SHM_ALLOC_SIZE_MAX )
+        size = SHM_ALLOC_SIZE_MAX;
+    nslabs = size / SHM_ALLOC_SLAB;
+    first = (sizeof(*hdr) + nslabs * sizeof(struct shm_alloc_slab) + SHM_ALLOC_SLAB - 1) / SHM_ALLOC_SLAB;
+    if ( first >= nslabs )
+        return -1;
+
+    memset(hdr, 0, sizeof(*hdr));
+    memset(hdr->slabs, 0xff, nslabs * sizeof(struct shm_alloc_slab));
+    hdr->nslabs = nslabs;
+    hdr->size = size;
+    hdr->top = first;
+    __atomic_store_n(&hdr->magic, SHM_ALLOC_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static inline int shm_alloc_attach(struct shm_alloc *a, void *mem) {
+    a->hdr = (struct shm_alloc_hdr *)mem;
+    a->base = (char *)mem;
+    return __atomic_load_n(&a->hdr->magic, __ATOMIC_ACQUIRE) == SHM_ALLOC_MAGIC ? 0 : -1;
+}
+
+//--- Вставляет в список цепочку блоков first..last (уже связанную через первые 8 байт блоков)
+static inline void shm_alloc_push(struct shm_alloc *a, uint64_t *head, shm_off_t first, shm_off_t last) {
+    uint64_t old = __atomic_load_n(head, __ATOMIC_RELAXED);
+
+    do {
+        __atomic_store_n((shm_off_t *)(a->base + last), SHM_ALLOC_HEAD_OFF(old), __ATOMIC_RELAXED);
+    } while ( !__atomic_compare_exchange_n(head, &old, SHM_ALLOC_HEAD(SHM_ALLOC_HEAD_TAG(old) + 1, first),
+                                           1, __ATOMIC_RELEASE, __ATOMIC_RELAXED) );
+}
+
+static inline shm_off_t shm_alloc_pop(struct shm_alloc *a, uint64_t *head) {
+    uint64_t old = __atomic_load_n(head, __ATOMIC_ACQUIRE), next;
+    shm_off_t off;
+
+    do {
+        if ( (off = SHM_ALLOC_HEAD_OFF(old)) == 0 )
+            return 0;
+        //--- блок могли уже забрать и исписать - тогда и голова изменилась, и CAS не пройдет
+        next = __atomic_load_n((shm_off_t *)(a->base + off), __ATOMIC_RELAXED);
+    } while ( !__atomic_compare_exchange_n(head, &old, SHM_ALLOC_HEAD(SHM_ALLOC_HEAD_TAG(old) + 1, next),
+                                           1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE) );
+    return off;
+}
+
+//--- Новый слэб для класса cls арены arena: первый блок возвращается сразу, остальные уходят в список
+static inline shm_off_t shm_alloc_refill(struct shm_alloc *a, unsigned arena, int cls) {
+    size_t bsize = (size_t)SHM_ALLOC_MIN << cls;
+    uint32_t slab = __atomic_fetch_add(&a->hdr->top, 1, __ATOMIC_RELAXED);
+    shm_off_t first, off;
+
+    if ( slab >= a->hdr->nslabs ) {
+        __atomic_store_n(&a->hdr->top, a->hdr->nslabs, __ATOMIC_RELAXED);
+        return 0;
+    }
+    a->hdr->slabs[slab].cls = cls;
+    a->hdr->slabs[slab].arena = arena;
+
+    first = (shm_off_t)slab * SHM_ALLOC_SLAB;
+    if ( bsize < SHM_ALLOC_SLAB ) {
+        for ( off = first + bsize; off + bsize < first + SHM_ALLOC_SLAB; off += bsize )
+            *(shm_off_t *)(a->base + off) = off + bsize;
+        shm_alloc_push(a, &a->hdr->arenas[arena].free[cls], first + bsize, off);
+    }
+    return first;
+}
+
+static inline unsigned shm_alloc_arena(struct shm_alloc *a) {
+    if ( !shm_alloc_my_arena )
+        shm_alloc_my_arena = __atomic_fetch_add(&a->hdr->next_arena, 1, __ATOMIC_RELAXED) % SHM_ALLOC_ARENAS + 1;
+    return shm_alloc_my_arena - 1;
+}
+
+//--- Выделяет size байт, возвращает смещение блока или 0, если памяти нет
+//--- или size больше SHM_ALLOC_MAX. Блок выровнен на min(размер блока, SHM_ALLOC_SLAB).
+static inline shm_off_t shm_malloc(struct shm_alloc *a, size_t size) {
+    int cls = shm_alloc_class(size ? size : 1);
+    unsigned arena, i;
+    shm_off_t off;
+
+    if ( cls < 0 )
+        return 0;
+    arena = shm_alloc_arena(a);
+    if ( (off = shm_alloc_pop(a, &a->hdr->arenas[arena].free[cls])) != 0 )
+        return off;
+    if ( (off = shm_alloc_refill(a, arena, cls)) != 0 )
+        return off;
+    //--- новых слэбов нет - берем свободный блок у других арен
+    for ( i = 1; i < SHM_ALLOC_ARENAS; i++ )
+        if ( (off = shm_alloc_pop(a, &a->hdr->arenas[(arena + i) % SHM_ALLOC_ARENAS].free[cls])) != 0 )
+            return off;
+    return 0;
+}
+
+//--- Возвращает блок в список арены, которой принадлежит его слэб
+static inline void shm_free(struct shm_alloc *a, shm_off_t off) {
+    struct shm_alloc_slab *slab;
+
+    if ( !off )
+        return;
+    slab = &a->hdr->slabs[off / SHM_ALLOC_SLAB];
+    shm_alloc_push(a, &a->hdr->arenas[slab->arena].free[slab->cls], off, off);
+}
+
+//--- Размер блока, выделенного под off
+static inline size_t shm_alloc_usable_size(const struct shm_alloc *a, shm_off_t off) {
+    return (size_t)SHM_ALLOC_MIN << a->hdr->slabs[off / SHM_ALLOC_SLAB].cls;
+}
+
+static inline shm_off_t shm_alloc_get_root(const struct shm_alloc *a) {
+    return __atomic_load_n(&a->hdr->root, __ATOMIC_ACQUIRE);
+}
+
+//--- Публикация корня: все, что записано в блоки до вызова, будет видно прочитавшему корень
+static inline int shm_alloc_cas_root(struct shm_alloc *a, shm_off_t *expected, shm_off_t root) {
+    return __atomic_compare_exchange_n(&a->hdr->root, expected, root, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+#endif
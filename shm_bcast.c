@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "shm_segment.h"
+#include "bcast_ring.h"
+#include "latency_hist.h"
+
+#define SHM_BCAST_NAME     "my_shared_bcast"
+#define SHM_BCAST_CAPACITY 4096
+#define SHM_CREATE    1
+#define SHM_PUBLISH   2
+#define SHM_SUBSCRIBE 3
+#define SHM_STATS     4
+#define SHM_CLOSE     5
+
+//--- Запись потока: номер тика, время публикации и "котировка"
+struct tick {
+    uint64_t n;
+    uint64_t ts;
+    double   price;
+    char     symbol[8];
+};
+
+void usage(const char * s) {
+    printf("Usage: %s <create [capacity] [gate]|publish count|subscribe count [delay_us]|stats|unlink>\n", s);
+}
+
+static void publish(struct bcast_ring *ring, long count) {
+    struct tick t;
+    uint64_t start, ns;
+    long i;
+
+    memset(&t, 0, sizeof(t));
+    strcpy(t.symbol, "EURUSD");
+    start = now_ns();
+    for ( i = 0; i < count; i++ ) {
+        t.n = i;
+        t.price = 1.08 + (i % 1000) * 1e-5;
+        t.ts = now_ns();
+        if ( bcast_ring_publish(ring, &t, sizeof(t)) == BCAST_WRITING ) {
+            perror("bcast_ring_publish");
+            return;
+        }
+    }
+    ns = now_ns() - start;
+    printf("Published %ld ticks in %.3f s (%.0f ticks/s)\n", count, ns / 1e9, count * 1e9 / (ns ? ns : 1));
+}
+
+//--- Читатель: задержка от публикации до чтения и потери. delay_us имитирует медленного читателя.
+static void subscribe(struct bcast_ring *ring, long count, long delay_us) {
+    struct tick t;
+    struct lat_hist hist;
+    uint64_t lost, total_lost = 0, expected = UINT64_MAX;
+    long received = 0, broken = 0;
+
+    if ( bcast_reader_join(ring) == -1 ) {
+        printf("No free reader slots (max %d)\n", BCAST_READERS);
+        return;
+    }
+    lat_hist_init(&hist);
+    while ( received + (long)total_lost < count ) {
+        bcast_ring_recv(ring, &t, sizeof(t), &lost);
+        lat_hist_record(&hist, now_ns() - t.ts);
+        total_lost += lost;
+        //--- номер тика должен совпасть с номером записи с учетом потерь
+        if ( expected != UINT64_MAX && t.n != expected + lost )
+            broken++;
+        expected = t.n + 1;
+        received++;
+        if ( delay_us )
+            usleep(delay_us);
+    }
+    bcast_reader_leave(ring);
+    printf("[%d] received %ld, lost %llu, out of order %ld, latency mean %.0f ns, p50 %llu ns, p99 %llu ns, max %llu ns\n",
+           (int)getpid(), received, (unsigned long long)total_lost, broken, lat_hist_mean(&hist),
+           (unsigned long long)lat_hist_percentile(&hist, 0.50),
+           (unsigned long long)lat_hist_percentile(&hist, 0.99),
+           (unsigned long long)hist.max);
+}
+
+static void stats(struct bcast_ring *ring) {
+    struct bcast_reader *rd;
+    uint64_t head = __atomic_load_n(&ring->hdr->head, __ATOMIC_ACQUIRE), cursor;
+    int i;
+
+    printf("head %llu, capacity %u, %s\n", (unsigned long long)head, ring->hdr->capacity,
+           (ring->hdr->flags & BCAST_GATED) ? "gated" : "not gated");
+    for ( i = 0; i < BCAST_READERS; i++ ) {
+        rd = &ring->hdr->readers[i];
+        if ( __atomic_load_n(&rd->active, __ATOMIC_ACQUIRE) != 2 )
+            continue;
+        cursor = __atomic_load_n(&rd->cursor, __ATOMIC_ACQUIRE);
+        printf("reader %d: pid %d, cursor %llu, lag %llu, lost %llu\n", i, rd->pid,
+               (unsigned long long)cursor, (unsigned long long)(head - cursor),
+               (unsigned long long)__atomic_load_n(&rd->lost, __ATOMIC_RELAXED));
+    }
+}
+
+int main (int argc, char ** argv) {
+    int cmd, i;
+    long count = 0, delay_us = 0;
+    uint32_t capacity = SHM_BCAST_CAPACITY, flags = 0;
+    size_t size;
+    void *addr;
+    struct bcast_ring ring;
+
+    //--- разбор командной строки
+    if ( argc < 2 ) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if ( !strcmp(argv[1], "create") ) {
+        for ( i = 2; i < argc; i++ ) {
+            if ( !strcmp(argv[i], "gate") )
+                flags |= BCAST_GATED;
+            else
+                capacity = strtoul(argv[i], NULL, 0);
+        }
+        if ( !capacity || (capacity & (capacity - 1)) ) {
+            printf("Capacity must be a power of two\n");
+            return 1;
+        }
+        cmd = SHM_CREATE;
+    } else if ( !strcmp(argv[1], "publish") && (argc == 3) ) {
+        count = atol(argv[2]);
+        cmd = SHM_PUBLISH;
+    } else if ( !strcmp(argv[1], "subscribe") && (argc == 3 || argc == 4) ) {
+        count = atol(argv[2]);
+        if ( argc == 4 )
+            delay_us = atol(argv[3]);
+        cmd = SHM_SUBSCRIBE;
+    } else if ( !strcmp(argv[1], "stats") ) {
+        cmd = SHM_STATS;
+    } else if ( !strcmp(argv[1], "unlink") ) {
+        cmd = SHM_CLOSE;
+    } else {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if ( cmd == SHM_CLOSE ) {
+        if ( shm_unlink(SHM_BCAST_NAME) == -1 )
+            perror("shm_unlink");
+        return 0;
+    }
+
+    size = bcast_ring_size(capacity);
+    if ( (addr = shm_segment_map(SHM_BCAST_NAME, &size, cmd == SHM_CREATE, SHM_SEG_POPULATE)) == NULL )
+        return 1;
+    if ( cmd == SHM_CREATE )
+        bcast_ring_init(addr, capacity, flags);
+    if ( bcast_ring_attach(&ring, addr) == -1 ) {
+        printf("%s is not a broadcast ring, run '%s create' first\n", SHM_BCAST_NAME, argv[0]);
+        return 1;
+    }
+
+    switch ( cmd ) {
+    case SHM_CREATE:
+        printf("Broadcast ring of %u slots created%s.\n", capacity, (flags & BCAST_GATED) ? ", writer is gated by readers" : "");
+        break;
+    case SHM_PUBLISH:
+        publish(&ring, count);
+        break;
+    case SHM_SUBSCRIBE:
+        subscribe(&ring, count, delay_us);
+        break;
+    case SHM_STATS:
+        stats(&ring);
+        break;
+    }
+
+    shm_segment_close(addr, size);
+    return 0;
+}
+
+/*
+Широковещательное кольцо
+
+Чтобы раздать один поток многим читателям через mkfifo, нужен свой канал на каждого
+читателя и N копий каждого байта. Здесь поток лежит в разделяемой памяти один раз
+(bcast_ring.h): писатель нумерует записи, а каждый читатель ведет свой курсор
+и читает записи сам, ничего не удаляя из кольца.
+
+Писатель никого не ждет: если читатель отстал больше чем на круг, его записи
+перезаписываются. Читатель узнает об этом по номеру записи в ячейке - перед записью
+ячейка помечается "в работе", после - получает новый номер, поэтому чтение, которое
+пересеклось с перезаписью, просто повторяется. Отставший читатель перескакивает
+на самую старую живую запись и получает число потерянных (lost).
+
+С ключом gate писатель перед тем, как перезаписать ячейку, проверяет курсоры
+всех зарегистрированных читателей и ждет самого медленного (спит на futex).
+Курсоры перечитываются, только когда запас, увиденный в прошлый раз, исчерпан.
+Читатель, процесс которого умер, гейтинг не остановит: его место освобождается
+при очередной проверке (kill(pid, 0)).
+
+Компилируем:
+
+$ g++ -O2 -o shm_bcast shm_bcast.c -pthread -lrt
+
+$ ./shm_bcast create 4096
+Broadcast ring of 4096 slots created.
+
+Читатели - каждый в своей консоли, второй медленный:
+
+$ ./shm_bcast subscribe 1000000
+$ ./shm_bcast subscribe 1000000 10
+$ ./shm_bcast stats
+
+$ ./shm_bcast publish 1000000
+Published 1000000 ticks in 0.091 s (10989011 ticks/s)
+
+Быстрый читатель получает все тики, медленный - сообщает о потерях. После
+'./shm_bcast create 4096 gate' потерь нет, но писатель идет со скоростью медленного.
+
+$ ./shm_bcast unlink
+*/
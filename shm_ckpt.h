@@ -0,0 +1,293 @@
+#ifndef SHM_CKPT_H
+#define SHM_CKPT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shm_segment.h"
+
+//--- Инкрементальный снимок сегмента разделяемой памяти на диск.
+//--- Писатель после изменения памяти отмечает затронутые страницы в битовой карте
+//--- (shm_ckpt_mark). Карта лежит в отдельном сегменте <name>.dirty, поэтому ее видят
+//--- писатели из всех процессов. Снимок (shm_ckpt_save) атомарно забирает отметки
+//--- и пишет в файл только эти страницы, по одному pwrite() на непрерывный кусок.
+//---
+//--- Файл снимка: страница заголовка, затем образ сегмента с тем же смещением страниц,
+//--- поэтому восстановление (shm_ckpt_restore) - это mmap() файла и копирование в сегмент.
+//---
+//--- Страница, которую меняют прямо во время снимка, может попасть в файл наполовину
+//--- новой, но писатель отметит ее снова, и следующий снимок ее перепишет. Согласованный
+//--- снимок структуры получается, если повторять shm_ckpt_save(), пока структура менялась
+//--- (например, под seqlock, см. shm.c).
+
+#define SHM_CKPT_MAGIC 0x54504b43 // "CKPT"
+#define SHM_CKPT_CLEAN 0
+#define SHM_CKPT_BUSY  1 // снимок пишется: страницы в файле могут быть из разных снимков
+
+struct shm_ckpt_dirty {
+    uint32_t magic;
+    uint32_t page_size;
+    uint64_t pages;
+    uint64_t bits[]; // 1 - страница изменена после последнего снимка
+};
+
+struct shm_ckpt_file_hdr {
+    uint32_t magic;
+    uint32_t state;      // SHM_CKPT_CLEAN / SHM_CKPT_BUSY
+    uint64_t size;       // размер сегмента
+    uint64_t page_size;  // с этого смещения начинается образ сегмента
+    uint64_t generation; // номер последнего завершенного снимка
+};
+
+struct shm_ckpt {
+    char                  *addr;  // отслеживаемый сегмент
+    size_t                 size;
+    size_t                 page_size;
+    struct shm_ckpt_dirty *dirty;
+    size_t                 dirty_size;
+};
+
+static inline void shm_ckpt_dirty_name(char *buf, size_t len, const char *name) {
+    snprintf(buf, len, "%s.dirty", name);
+}
+
+//--- Подключает к сегменту addr/size карту изменений <name>.dirty.
+//--- Новая карта отмечает все страницы: первый снимок будет полным.
+//--- Если сегмент вырос (create --size), карта растет вместе с ним, а новые страницы
+//--- отмечаются измененными.
+static inline int shm_ckpt_attach(struct shm_ckpt *ck, const char *name, void *addr, size_t size) {
+    char dname[256];
+    uint64_t pages, old, i;
+
+    ck->addr = (char *)addr;
+    ck->size = size;
+    ck->page_size = sysconf(_SC_PAGESIZE);
+    pages = (size + ck->page_size - 1) / ck->page_size;
+    ck->dirty_size = sizeof(struct shm_ckpt_dirty) + (pages + 63) / 64 * sizeof(uint64_t);
+
+    shm_ckpt_dirty_name(dname, sizeof(dname), name);
+    if ( (ck->dirty = (struct shm_ckpt_dirty *)shm_segment_map(dname, &ck->dirty_size, 1, 0)) == NULL )
+        return -1;
+    if ( __atomic_load_n(&ck->dirty->magic, __ATOMIC_ACQUIRE) != SHM_CKPT_MAGIC ) {
+        ck->dirty->page_size = ck->page_size;
+        ck->dirty->pages = pages;
+        for ( i = 0; i < (pages + 63) / 64; i++ )
+            ck->dirty->bits[i] = ~0ULL;
+        __atomic_store_n(&ck->dirty->magic, SHM_CKPT_MAGIC, __ATOMIC_RELEASE);
+    } else if ( ck->dirty->page_size != ck->page_size ) {
+        fprintf(stderr, "%s does not match the segment, remove it\n", dname);
+        shm_segment_close(ck->dirty, ck->dirty_size);
+        return -1;
+    } else if ( (old = __atomic_load_n(&ck->dirty->pages, __ATOMIC_ACQUIRE)) < pages ) {
+        //--- shm_segment_map() уже увеличил карту до dirty_size, новые слова в ней нулевые
+        for ( i = old; i < pages; i++ )
+            __atomic_fetch_or(&ck->dirty->bits[i / 64], 1ULL << (i % 64), __ATOMIC_RELEASE);
+        while ( old < pages && !__atomic_compare_exchange_n(&ck->dirty->pages, &old, pages, 0,
+                                                            __ATOMIC_RELEASE, __ATOMIC_ACQUIRE) )
+            ;
+    }
+    return 0;
+}
+
+static inline void shm_ckpt_detach(struct shm_ckpt *ck) {
+    shm_segment_close(ck->dirty, ck->dirty_size);
+}
+
+static inline int shm_ckpt_unlink(const char *name) {
+    char dname[256];
+
+    shm_ckpt_dirty_name(dname, sizeof(dname), name);
+    return shm_unlink(dname);
+}
+
+//--- Писатель: отмечает страницы [p, p + len) после того, как изменил их.
+//--- Бит, уже стоящий в карте, не пишется - повторные изменения не гоняют строку кэша
+//--- карты между писателями. Барьер нужен, чтобы запись данных не "обогнала" проверку бита:
+//--- иначе снимок может снять бит и скопировать страницу еще без наших изменений.
+static inline void shm_ckpt_mark(struct shm_ckpt *ck, const void *p, size_t len) {
+    size_t first, last, i;
+    uint64_t bit;
+
+    if ( !len )
+        return;
+    first = ((const char *)p - ck->addr) / ck->page_size;
+    last = ((const char *)p - ck->addr + len - 1) / ck->page_size;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for ( i = first; i <= last; i++ ) {
+        bit = 1ULL << (i % 64);
+        if ( !(__atomic_load_n(&ck->dirty->bits[i / 64], __ATOMIC_RELAXED) & bit) )
+            __atomic_fetch_or(&ck->dirty->bits[i / 64], bit, __ATOMIC_RELEASE);
+    }
+}
+
+//--- Все страницы считаются сохраненными (например, сразу после восстановления)
+static inline void shm_ckpt_clear(struct shm_ckpt *ck) {
+    uint64_t i;
+
+    for ( i = 0; i < (ck->dirty->pages + 63) / 64; i++ )
+        __atomic_store_n(&ck->dirty->bits[i], 0, __ATOMIC_RELAXED);
+}
+
+static inline int shm_ckpt_write_hdr(int fd, struct shm_ckpt_file_hdr *hdr) {
+    if ( pwrite(fd, hdr, sizeof(*hdr), 0) != (ssize_t)sizeof(*hdr) || fdatasync(fd) == -1 )
+        return -1;
+    return 0;
+}
+
+//--- Пишет страницы [first, first + n) сегмента в файл снимка
+static inline int shm_ckpt_write_run(struct shm_ckpt *ck, int fd, size_t first, size_t n) {
+    size_t off = first * ck->page_size, len = n * ck->page_size, done = 0;
+    ssize_t w;
+
+    if ( off + len > ck->size )
+        len = ck->size - off;
+    while ( done < len ) {
+        if ( (w = pwrite(fd, ck->addr + off + done, len - done, ck->page_size + off + done)) <= 0 ) {
+            if ( w == -1 && errno == EINTR )
+                continue;
+            return -1;
+        }
+        done += w;
+    }
+    return 0;
+}
+
+//--- Снимок: пишет в path страницы, измененные после прошлого снимка.
+//--- Возвращает число записанных страниц или -1. При ошибке отметки возвращаются в карту.
+static inline long shm_ckpt_save(struct shm_ckpt *ck, const char *path) {
+    struct shm_ckpt_file_hdr hdr;
+    size_t words = (ck->dirty->pages + 63) / 64, i, page, run = 0, run_len = 0;
+    uint64_t w, bit;
+    long written = 0;
+    int fd, rc = 0;
+    struct stat st;
+
+    if ( (fd = open(path, O_RDWR|O_CREAT, 0666)) == -1 || fstat(fd, &st) == -1 ) {
+        perror(path);
+        if ( fd != -1 )
+            close(fd);
+        return -1;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    if ( st.st_size >= (off_t)sizeof(hdr) && pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) )
+        hdr.magic = 0;
+    if ( hdr.magic != SHM_CKPT_MAGIC || hdr.size != ck->size || hdr.page_size != ck->page_size ) {
+        //--- чужой или новый файл: в нем нет ни одной нашей страницы
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.magic = SHM_CKPT_MAGIC;
+        hdr.size = ck->size;
+        hdr.page_size = ck->page_size;
+        for ( i = 0; i < words; i++ )
+            __atomic_store_n(&ck->dirty->bits[i], ~0ULL, __ATOMIC_RELAXED);
+    }
+    hdr.state = SHM_CKPT_BUSY;
+    if ( ftruncate(fd, ck->page_size + ck->size) == -1 || shm_ckpt_write_hdr(fd, &hdr) == -1 ) {
+        perror("checkpoint");
+        close(fd);
+        return -1;
+    }
+
+    for ( i = 0; i < words && rc == 0; i++ ) {
+        if ( !__atomic_load_n(&ck->dirty->bits[i], __ATOMIC_RELAXED) )
+            continue;
+        //--- отметки снимаются до копирования: изменение во время копирования отметит страницу снова
+        w = __atomic_exchange_n(&ck->dirty->bits[i], 0, __ATOMIC_SEQ_CST);
+        for ( bit = 0; bit < 64 && rc == 0; bit++ ) {
+            page = i * 64 + bit;
+            if ( !(w & (1ULL << bit)) || page * ck->page_size >= ck->size )
+                continue;
+            if ( run_len && run + run_len == page ) {
+                run_len++;
+                continue;
+            }
+            if ( run_len && (rc = shm_ckpt_write_run(ck, fd, run, run_len)) == 0 )
+                written += run_len;
+            run = page;
+            run_len = 1;
+        }
+        if ( rc )
+            __atomic_fetch_or(&ck->dirty->bits[i], w, __ATOMIC_RELAXED);
+    }
+    if ( rc == 0 && run_len && (rc = shm_ckpt_write_run(ck, fd, run, run_len)) == 0 )
+        written += run_len;
+    if ( rc ) {
+        //--- незаписанные страницы: уже снятые отметки пропали бы вместе с изменениями
+        for ( page = run; page < run + run_len; page++ )
+            __atomic_fetch_or(&ck->dirty->bits[page / 64], 1ULL << (page % 64), __ATOMIC_RELAXED);
+        perror("pwrite");
+        close(fd);
+        return -1;
+    }
+
+    //--- страницы на диске раньше, чем заголовок скажет, что снимок завершен
+    if ( fdatasync(fd) == -1 ) {
+        perror("fdatasync");
+        close(fd);
+        return -1;
+    }
+    hdr.state = SHM_CKPT_CLEAN;
+    hdr.generation++;
+    if ( shm_ckpt_write_hdr(fd, &hdr) == -1 ) {
+        perror("checkpoint");
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    return written;
+}
+
+//--- Создает сегмент name из снимка path. Файл отображается в память, и в сегмент
+//--- копируются только ненулевые страницы: нулевые остаются дырами и не занимают памяти.
+//--- В *size возвращается размер сегмента.
+static inline void *shm_ckpt_restore(const char *name, const char *path, size_t *size, int flags) {
+    struct shm_ckpt_file_hdr hdr;
+    static const char zero[4096] = { 0 };
+    char *file, *addr;
+    size_t off, len;
+    int fd, sparse;
+
+    if ( (fd = open(path, O_RDONLY)) == -1 ) {
+        perror(path);
+        return NULL;
+    }
+    if ( pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) || hdr.magic != SHM_CKPT_MAGIC ) {
+        fprintf(stderr, "%s is not a checkpoint\n", path);
+        close(fd);
+        return NULL;
+    }
+    if ( hdr.state != SHM_CKPT_CLEAN ) {
+        fprintf(stderr, "%s: checkpoint was interrupted, pages may be inconsistent\n", path);
+        close(fd);
+        return NULL;
+    }
+    file = (char *)mmap(0, hdr.page_size + hdr.size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if ( file == (char *)MAP_FAILED ) {
+        perror("mmap");
+        return NULL;
+    }
+    madvise(file, hdr.page_size + hdr.size, MADV_SEQUENTIAL);
+
+    *size = hdr.size;
+    if ( (addr = (char *)shm_segment_map(name, size, 1, flags)) == NULL ) {
+        munmap(file, hdr.page_size + hdr.size);
+        return NULL;
+    }
+    //--- старое содержимое существующего сегмента выбрасывается целиком (дыра в файле
+    //--- tmpfs); если ядро этого не умеет - копируем и нулевые страницы
+    sparse = madvise(addr, *size, MADV_REMOVE) == 0;
+    for ( off = 0; off < hdr.size; off += sizeof(zero) ) {
+        len = hdr.size - off < sizeof(zero) ? hdr.size - off : sizeof(zero);
+        if ( !sparse || memcmp(file + hdr.page_size + off, zero, len) )
+            memcpy(addr + off, file + hdr.page_size + off, len);
+    }
+    munmap(file, hdr.page_size + hdr.size);
+    return addr;
+}
+
+#endif
@@ -0,0 +1,256 @@
+#ifndef SHM_HASH_H
+#define SHM_HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "ipc_common.h"
+#include "seqlock.h"
+
+//--- Хеш-таблица фиксированной емкости в разделяемой памяти, открытая адресация.
+//--- Слоты собраны в группы по SHM_HASH_GROUP: первая строка кэша группы - заголовок
+//--- (seqlock, состояния слотов и их хеши), за ней по строке кэша на каждый слот.
+//--- Поиск сравнивает хеши в заголовке и трогает строку слота только при совпадении,
+//--- т.е. удачный поиск обычно читает две строки кэша, неудачный - одну.
+//---
+//--- Каждую группу защищает свой seqlock: читатели ничего не пишут и перечитывают
+//--- группу, если она изменилась во время чтения; писатели разных групп не мешают друг другу.
+//--- Если группа заполнена, ключ уходит в следующую (линейное пробирование по группам).
+//--- Поиск останавливается на группе, в которой есть ни разу не занятый слот.
+
+#define SHM_HASH_MAGIC   0x48415348 // "HASH"
+#define SHM_HASH_GROUP   8
+#define SHM_HASH_KEY_MAX 30
+#define SHM_HASH_VAL_MAX 32
+
+#define SHM_HASH_EMPTY 0 // слот ни разу не занимался - на нем цепочка проб заканчивается
+#define SHM_HASH_USED  1
+#define SHM_HASH_TOMB  2 // ключ удален; слот можно занять снова, но поиск идет дальше
+
+struct shm_hash_entry {
+    uint8_t klen;
+    uint8_t vlen;
+    char    key[SHM_HASH_KEY_MAX];
+    char    val[SHM_HASH_VAL_MAX];
+} CACHE_ALIGNED;
+
+struct shm_hash_group {
+    struct seqlock        lock;
+    uint8_t               state[SHM_HASH_GROUP];
+    uint32_t              hash[SHM_HASH_GROUP];
+    struct shm_hash_entry slots[SHM_HASH_GROUP];
+} CACHE_ALIGNED;
+
+struct shm_hash_hdr {
+    uint32_t magic;
+    uint32_t ngroups;            // степень двойки
+    uint64_t count CACHE_ALIGNED; // число ключей, только для статистики
+} CACHE_ALIGNED;
+
+struct shm_hash {
+    struct shm_hash_hdr   *hdr;
+    struct shm_hash_group *groups;
+    uint32_t               mask;
+};
+
+//--- FNV-1a, 64 бита: младшие биты выбирают группу, старшие 32 - хеш внутри группы
+static inline uint64_t shm_hash_fn(const void *key, size_t len) {
+    const unsigned char *p = (const unsigned char *)key;
+    uint64_t h = 14695981039346656037ull;
+
+    while ( len-- )
+        h = (h ^ *p++) * 1099511628211ull;
+    return h ^ (h >> 29);
+}
+
+//--- Число групп для capacity ключей: не больше 3/4 слотов заняты
+static inline uint32_t shm_hash_groups(uint32_t capacity) {
+    uint32_t n = 1;
+
+    while ( (uint64_t)n * SHM_HASH_GROUP * 3 / 4 < capacity )
+        n <<= 1;
+    return n;
+}
+
+static inline size_t shm_hash_size(uint32_t capacity) {
+    return sizeof(struct shm_hash_hdr) + (size_t)shm_hash_groups(capacity) * sizeof(struct shm_hash_group);
+}
+
+//--- Разметка свежей памяти. Вызывается один раз создателем сегмента.
+static inline void shm_hash_init(void *mem, uint32_t capacity) {
+    struct shm_hash_hdr *hdr = (struct shm_hash_hdr *)mem;
+    uint32_t ngroups = shm_hash_groups(capacity);
+
+    memset(hdr, 0, sizeof(*hdr) + (size_t)ngroups * sizeof(struct shm_hash_group));
+    hdr->ngroups = ngroups;
+    __atomic_store_n(&hdr->magic, SHM_HASH_MAGIC, __ATOMIC_RELEASE);
+}
+
+static inline int shm_hash_attach(struct shm_hash *h, void *mem) {
+    h->hdr = (struct shm_hash_hdr *)mem;
+    h->groups = (struct shm_hash_group *)(h->hdr + 1);
+    if ( __atomic_load_n(&h->hdr->magic, __ATOMIC_ACQUIRE) != SHM_HASH_MAGIC )
+        return -1;
+    h->mask = h->hdr->ngroups - 1;
+    return 0;
+}
+
+static inline int shm_hash_trylock(struct shm_hash_group *g) {
+    uint32_t seq = __atomic_load_n(&g->lock.seq, __ATOMIC_RELAXED);
+
+    if ( (seq & 1) || !__atomic_compare_exchange_n(&g->lock.seq, &seq, seq + 1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED) )
+        return -1;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return 0;
+}
+
+//--- Ищет ключ в группе. Возвращает номер слота или -1; *end != 0, если в группе
+//--- есть пустой слот, т.е. дальше искать не нужно. Найденный слот копируется в *out.
+//--- Без seqlock результат согласован, только если группу держим мы сами.
+static inline int shm_hash_scan(const struct shm_hash_group *g, uint32_t hash, const void *key, size_t klen,
+                                struct shm_hash_entry *out, int *end) {
+    int i;
+
+    *end = 0;
+    for ( i = 0; i < SHM_HASH_GROUP; i++ ) {
+        if ( g->state[i] == SHM_HASH_EMPTY )
+            *end = 1;
+        else if ( g->state[i] == SHM_HASH_USED && g->hash[i] == hash &&
+                  g->slots[i].klen == klen && !memcmp(g->slots[i].key, key, klen) ) {
+            if ( out )
+                memcpy(out, &g->slots[i], sizeof(*out));
+            return i;
+        }
+    }
+    return -1;
+}
+
+//--- То же без захвата группы: повторяем, пока писатель не оставит группу в покое
+static inline int shm_hash_probe(const struct shm_hash_group *g, uint32_t hash, const void *key, size_t klen,
+                                 struct shm_hash_entry *out, int *end) {
+    uint32_t seq;
+    int found;
+
+    do {
+        seq = seqlock_read_begin(&g->lock);
+        found = shm_hash_scan(g, hash, key, klen, out, end);
+    } while ( seqlock_read_retry(&g->lock, seq) );
+    return found;
+}
+
+//--- Поиск: копирует значение в val (не больше vcap байт), возвращает его длину или -1
+static inline int shm_hash_get(const struct shm_hash *h, const void *key, size_t klen, void *val, size_t vcap) {
+    uint64_t hv = shm_hash_fn(key, klen);
+    uint32_t gi = (uint32_t)hv & h->mask, n;
+    struct shm_hash_entry e;
+    int end;
+
+    for ( n = 0; n <= h->mask; n++, gi = (gi + 1) & h->mask ) {
+        if ( shm_hash_probe(&h->groups[gi], (uint32_t)(hv >> 32), key, klen, &e, &end) >= 0 ) {
+            memcpy(val, e.val, e.vlen < vcap ? e.vlen : vcap);
+            return e.vlen;
+        }
+        if ( end )
+            break;
+    }
+    return -1;
+}
+
+//--- Общая часть записи и удаления. Все писатели одного ключа сначала захватывают его
+//--- домашнюю группу, поэтому ключ не может появиться в таблице дважды. Группу, в которой
+//--- надо что-то поменять, захватываем через trylock: если занята - отпускаем домашнюю
+//--- и начинаем заново, так писатели с разными домашними группами не зациклятся друг на друге.
+static inline int shm_hash_update(struct shm_hash *h, const void *key, size_t klen, const void *val, size_t vlen, int del) {
+    uint64_t hv = shm_hash_fn(key, klen);
+    uint32_t hash = (uint32_t)(hv >> 32), home = (uint32_t)hv & h->mask, gi, n, free_gi = 0;
+    struct shm_hash_group *g;
+    uint32_t seq;
+    int i, slot, free_slot, end;
+
+    if ( klen > SHM_HASH_KEY_MAX || vlen > SHM_HASH_VAL_MAX )
+        return -1;
+retry:
+    seqlock_write_begin(&h->groups[home].lock);
+    free_slot = -1;
+    slot = -1;
+    for ( n = 0, gi = home; n <= h->mask; n++, gi = (gi + 1) & h->mask ) {
+        g = &h->groups[gi];
+        //--- домашнюю группу держим мы, ее seqlock нечетный и читать ее можно напрямую.
+        //--- Чужую группу читаем как читатель, но не ждем ее писателя: он сам может ждать нашу.
+        seq = gi == home ? 0 : __atomic_load_n(&g->lock.seq, __ATOMIC_ACQUIRE);
+        if ( seq & 1 )
+            goto busy;
+        slot = shm_hash_scan(g, hash, key, klen, NULL, &end);
+        if ( gi != home && seqlock_read_retry(&g->lock, seq) )
+            goto busy;
+        if ( slot >= 0 )
+            break;
+        //--- первый слот, куда можно положить новый ключ
+        if ( free_slot < 0 )
+            for ( i = 0; i < SHM_HASH_GROUP; i++ )
+                if ( __atomic_load_n(&g->state[i], __ATOMIC_RELAXED) != SHM_HASH_USED ) {
+                    free_gi = gi;
+                    free_slot = i;
+                    break;
+                }
+        if ( end )
+            break;
+    }
+
+    if ( slot < 0 ) {
+        if ( del || free_slot < 0 ) {
+            seqlock_write_end(&h->groups[home].lock);
+            return -1; // удалять нечего или таблица заполнена
+        }
+        gi = free_gi;
+        slot = free_slot;
+    }
+
+    g = &h->groups[gi];
+    if ( gi != home && shm_hash_trylock(g) == -1 )
+        goto busy;
+    //--- пока мы не держали группу, слот мог занять чужой ключ
+    if ( g->state[slot] == SHM_HASH_USED &&
+         (g->hash[slot] != hash || g->slots[slot].klen != klen || memcmp(g->slots[slot].key, key, klen)) ) {
+        if ( gi != home )
+            seqlock_write_end(&g->lock);
+        seqlock_write_end(&h->groups[home].lock);
+        goto retry;
+    }
+
+    if ( del ) {
+        g->state[slot] = SHM_HASH_TOMB;
+        __atomic_fetch_sub(&h->hdr->count, 1, __ATOMIC_RELAXED);
+    } else {
+        if ( g->state[slot] != SHM_HASH_USED ) {
+            g->hash[slot] = hash;
+            g->slots[slot].klen = klen;
+            memcpy(g->slots[slot].key, key, klen);
+            __atomic_fetch_add(&h->hdr->count, 1, __ATOMIC_RELAXED);
+        }
+        g->slots[slot].vlen = vlen;
+        memcpy(g->slots[slot].val, val, vlen);
+        g->state[slot] = SHM_HASH_USED;
+    }
+
+    if ( gi != home )
+        seqlock_write_end(&g->lock);
+    seqlock_write_end(&h->groups[home].lock);
+    return 0;
+
+busy:
+    seqlock_write_end(&h->groups[home].lock);
+    cpu_relax();
+    goto retry;
+}
+
+//--- Вставка или замена значения. -1 - ключ/значение слишком длинные или таблица заполнена.
+static inline int shm_hash_put(struct shm_hash *h, const void *key, size_t klen, const void *val, size_t vlen) {
+    return shm_hash_update(h, key, klen, val, vlen, 0);
+}
+
+static inline int shm_hash_del(struct shm_hash *h, const void *key, size_t klen) {
+    return shm_hash_update(h, key, klen, NULL, 0, 1);
+}
+
+#endif
@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "shm_segment.h"
+#include "shm_alloc.h"
+
+#define SHM_HEAP_NAME   "my_shared_heap"
+#define SHM_HEAP_SIZE   (16 * 1024 * 1024)
+#define STRESS_LIVE     256 // сколько блоков держит каждый процесс в stress
+#define SHM_CREATE  1
+#define SHM_ADD     2
+#define SHM_PRINT   3
+#define SHM_CLOSE   4
+#define SHM_CLEAR   5
+#define SHM_STRESS  6
+#define SHM_STATS   7
+
+//--- Запись переменной длины, собранная прямо в разделяемой памяти.
+//--- Записи связаны в список через смещения, голова списка - корень распределителя.
+struct shm_record {
+    shm_off_t next;
+    pid_t     pid;
+    uint32_t  len;
+    char      text[];
+};
+
+void usage(const char * s) {
+    printf("Usage: %s <create [megabytes]|add 'text'|print|clear|stress count|stats|unlink>\n", s);
+}
+
+//--- Добавляет запись в начало списка (стек Трайбера на корне распределителя)
+static int record_add(struct shm_alloc *a, const char *text) {
+    uint32_t len = strlen(text);
+    shm_off_t off, head;
+    struct shm_record *rec;
+
+    if ( (off = shm_malloc(a, sizeof(*rec) + len + 1)) == 0 )
+        return -1;
+    rec = (struct shm_record *)shm_ptr(a, off);
+    rec->pid = getpid();
+    rec->len = len;
+    memcpy(rec->text, text, len + 1);
+
+    head = shm_alloc_get_root(a);
+    do {
+        rec->next = head;
+    } while ( !shm_alloc_cas_root(a, &head, off) );
+    return 0;
+}
+
+//--- Проверка распределителя под нагрузкой: блоки случайного размера заполняются
+//--- байтом-меткой и проверяются перед освобождением. Запускайте в нескольких процессах сразу.
+static long stress(struct shm_alloc *a, long count) {
+    shm_off_t live[STRESS_LIVE] = { 0 };
+    size_t sizes[STRESS_LIVE];
+    unsigned seed = getpid();
+    long i, bad = 0, failed = 0;
+    int k;
+    size_t j;
+    unsigned char *p;
+
+    for ( i = 0; i < count; i++ ) {
+        k = rand_r(&seed) % STRESS_LIVE;
+        if ( live[k] ) {
+            p = (unsigned char *)shm_ptr(a, live[k]);
+            for ( j = 0; j < sizes[k]; j++ )
+                if ( p[j] != (unsigned char)(live[k] ^ k) ) {
+                    bad++;
+                    break;
+                }
+            shm_free(a, live[k]);
+        }
+        sizes[k] = 1 + rand_r(&seed) % (rand_r(&seed) % 8 ? 256 : SHM_ALLOC_MAX);
+        if ( (live[k] = shm_malloc(a, sizes[k])) == 0 ) {
+            failed++;
+            continue;
+        }
+        memset(shm_ptr(a, live[k]), (unsigned char)(live[k] ^ k), sizes[k]);
+    }
+    for ( k = 0; k < STRESS_LIVE; k++ )
+        shm_free(a, live[k]);
+    if ( failed )
+        printf("[%d] %ld allocations failed: segment is full\n", (int)getpid(), failed);
+    return bad;
+}
+
+//--- Сколько слэбов у каждого класса и сколько в них свободных блоков.
+//--- Списки обходятся без синхронизации, поэтому на работающем сегменте цифры приблизительные.
+static void stats(struct shm_alloc *a) {
+    uint32_t slabs[SHM_ALLOC_CLASSES] = { 0 }, s, n;
+    long nfree;
+    shm_off_t off;
+    int c, r;
+
+    for ( s = 0; s < a->hdr->nslabs; s++ )
+        if ( a->hdr->slabs[s].cls < SHM_ALLOC_CLASSES )
+            slabs[a->hdr->slabs[s].cls]++;
+    printf("segment %llu bytes, %u slabs of %d bytes, %u used\n", (unsigned long long)a->hdr->size,
+           a->hdr->nslabs, SHM_ALLOC_SLAB, a->hdr->top);
+    printf("class,block,slabs,free_blocks\n");
+    for ( c = 0; c < SHM_ALLOC_CLASSES; c++ ) {
+        for ( nfree = 0, r = 0; r < SHM_ALLOC_ARENAS; r++ )
+            for ( off = SHM_ALLOC_HEAD_OFF(a->hdr->arenas[r].free[c]), n = 0; off && n < a->hdr->nslabs * (SHM_ALLOC_SLAB / SHM_ALLOC_MIN); n++ ) {
+                nfree++;
+                off = *(shm_off_t *)shm_ptr(a, off);
+            }
+        printf("%d,%d,%u,%ld\n", c, SHM_ALLOC_MIN << c, slabs[c], nfree);
+    }
+}
+
+int main (int argc, char ** argv) {
+    int cmd;
+    long count = 0, bad;
+    size_t size = SHM_HEAP_SIZE;
+    void *addr;
+    struct shm_alloc heap;
+    struct shm_record *rec;
+    shm_off_t off, next;
+
+    //--- разбор командной строки
+    if ( argc < 2 ) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if ( !strcmp(argv[1], "create") ) {
+        if ( argc == 3 )
+            size = (size_t)strtoul(argv[2], NULL, 0) << 20;
+        cmd = SHM_CREATE;
+    } else if ( !strcmp(argv[1], "add") && (argc == 3) ) {
+        cmd = SHM_ADD;
+    } else if ( !strcmp(argv[1], "print") ) {
+        cmd = SHM_PRINT;
+    } else if ( !strcmp(argv[1], "clear") ) {
+        cmd = SHM_CLEAR;
+    } else if ( !strcmp(argv[1], "stress") && (argc == 3) ) {
+        count = atol(argv[2]);
+        cmd = SHM_STRESS;
+    } else if ( !strcmp(argv[1], "stats") ) {
+        cmd = SHM_STATS;
+    } else if ( !strcmp(argv[1], "unlink") ) {
+        cmd = SHM_CLOSE;
+    } else {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if ( cmd == SHM_CLOSE ) {
+        if ( shm_unlink(SHM_HEAP_NAME) == -1 )
+            perror("shm_unlink");
+        return 0;
+    }
+
+    if ( (addr = shm_segment_open(SHM_HEAP_NAME, &size, cmd == SHM_CREATE)) == NULL )
+        return 1;
+    if ( cmd == SHM_CREATE && shm_alloc_init(addr, size) == -1 ) {
+        printf("Segment of %zu bytes is too small for a heap\n", size);
+        return 1;
+    }
+    if ( shm_alloc_attach(&heap, addr) == -1 ) {
+        printf("%s is not a heap, run '%s create' first\n", SHM_HEAP_NAME, argv[0]);
+        return 1;
+    }
+
+    switch ( cmd ) {
+    case SHM_CREATE:
+        printf("Heap of %zu bytes created at %p.\n", size, addr);
+        break;
+    case SHM_ADD:
+        if ( record_add(&heap, argv[2]) == -1 )
+            printf("Out of shared memory\n");
+        break;
+    case SHM_PRINT:
+        //--- у каждого процесса свой адрес сегмента, а смещения в записях одни и те же
+        printf("heap at %p\n", addr);
+        for ( off = shm_alloc_get_root(&heap); off; off = rec->next ) {
+            rec = (struct shm_record *)shm_ptr(&heap, off);
+            printf("[%llu] from %d: %s\n", (unsigned long long)off, (int)rec->pid, rec->text);
+        }
+        break;
+    case SHM_CLEAR:
+        //--- снимаем весь список разом, после этого он принадлежит только нам
+        off = __atomic_exchange_n(&heap.hdr->root, 0, __ATOMIC_ACQ_REL);
+        for ( ; off; off = next ) {
+            next = ((struct shm_record *)shm_ptr(&heap, off))->next;
+            shm_free(&heap, off);
+        }
+        break;
+    case SHM_STRESS:
+        bad = stress(&heap, count);
+        printf("[%d] %ld allocations, %ld corrupted blocks\n", (int)getpid(), count, bad);
+        break;
+    case SHM_STATS:
+        stats(&heap);
+        break;
+    }
+
+    shm_segment_close(addr, size);
+    return 0;
+}
+
+/*
+Распределитель памяти в разделяемой памяти
+
+В shm_open.c данные попадают в разделяемую память одним memcpy() по адресу начала
+сегмента, т.е. структура данных ограничена одним буфером фиксированного размера.
+Чтобы строить в сегменте записи переменной длины, списки и деревья, нужен свой malloc()
+(shm_alloc.h), который работает внутри сегмента и обслуживает сразу все процессы:
+
+    - сегмент делится на слэбы по 64 КБ, каждый слэб нарезается на блоки одного
+      класса размеров: 16, 32, 64, ... 32768 байт;
+    - свободные блоки каждого класса лежат в lock-free списках (стек на CAS),
+      голова списка хранит счетчик изменений, чтобы не попасть на проблему ABA;
+    - списков несколько наборов (арен), потоки разных процессов раздаются по аренам
+      по кругу и не дерутся за одну голову списка;
+    - новый слэб берется одним атомарным сложением, освобожденный блок возвращается
+      в арену, которой принадлежит его слэб.
+
+Указатели в разделяемой памяти хранить нельзя: сегмент отображается в каждый процесс
+по своему адресу. Поэтому распределитель и записи используют смещения от начала сегмента
+(shm_off_t), а shm_ptr()/shm_off() переводят их в адреса и обратно.
+
+Компилируем:
+
+$ g++ -o shm_heap shm_heap.c -pthread -lrt
+
+$ ./shm_heap create 64
+Heap of 67108864 bytes created at 0x7f0c4a000000.
+$ ./shm_heap add 'Hello, my shared memory!'
+$ ./shm_heap add 'A much longer record that would not fit into the fifty bytes of shm_open.c'
+$ ./shm_heap print
+heap at 0x7f91d2800000
+[131120] from 20451: A much longer record that would not fit into the fifty bytes of shm_open.c
+[65536] from 20450: Hello, my shared memory!
+
+Несколько процессов, одновременно выделяющих и освобождающих блоки:
+
+$ ./shm_heap stress 1000000 & ./shm_heap stress 1000000 & ./shm_heap stress 1000000 & wait
+[20460] 1000000 allocations, 0 corrupted blocks
+...
+$ ./shm_heap stats
+$ ./shm_heap clear
+$ ./shm_heap unlink
+*/
@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "shm_segment.h"
+#include "shm_hash.h"
+#include "latency_hist.h"
+
+#define SHM_KV_NAME     "my_shared_hash"
+#define SHM_KV_CAPACITY 65536
+#define SHM_CREATE 1
+#define SHM_PUT    2
+#define SHM_GET    3
+#define SHM_CLOSE  4
+#define SHM_DEL    5
+#define SHM_LOAD   6
+#define SHM_BENCH  7
+#define SHM_STATS  8
+
+void usage(const char * s) {
+    printf("Usage: %s <create [capacity]|put key value|get key|del key|load count|bench count|stats|unlink>\n", s);
+}
+
+//--- Заполняет таблицу ключами key0..key<count-1>
+static int load(struct shm_hash *h, long count) {
+    char key[SHM_HASH_KEY_MAX + 1], val[SHM_HASH_VAL_MAX + 1];
+    long i;
+
+    for ( i = 0; i < count; i++ ) {
+        snprintf(key, sizeof(key), "key%ld", i);
+        snprintf(val, sizeof(val), "value%ld", i);
+        if ( shm_hash_put(h, key, strlen(key), val, strlen(val)) == -1 ) {
+            printf("Table is full after %ld keys\n", i);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+//--- Случайные поиски среди ключей, загруженных командой load: время каждого поиска в гистограмму
+static void bench(struct shm_hash *h, long count) {
+    char key[SHM_HASH_KEY_MAX + 1], val[SHM_HASH_VAL_MAX];
+    unsigned seed = getpid();
+    long i, n, keys = (long)h->hdr->count, misses = 0;
+    struct lat_hist hist;
+    uint64_t t0, t1, start;
+
+    if ( keys == 0 ) {
+        printf("Table is empty, run 'load' first\n");
+        return;
+    }
+    lat_hist_init(&hist);
+    start = now_ns();
+    for ( i = 0; i < count; i++ ) {
+        n = snprintf(key, sizeof(key), "key%ld", (long)(rand_r(&seed) % keys));
+        t0 = now_ns();
+        if ( shm_hash_get(h, key, n, val, sizeof(val)) < 0 )
+            misses++;
+        t1 = now_ns();
+        lat_hist_record(&hist, t1 - t0);
+    }
+    t1 = now_ns() - start;
+    printf("[%d] %ld lookups in %.3f s, %ld misses, mean %.0f ns, p50 %llu ns, p99 %llu ns, p99.9 %llu ns, max %llu ns\n",
+           (int)getpid(), count, t1 / 1e9, misses, lat_hist_mean(&hist),
+           (unsigned long long)lat_hist_percentile(&hist, 0.50),
+           (unsigned long long)lat_hist_percentile(&hist, 0.99),
+           (unsigned long long)lat_hist_percentile(&hist, 0.999),
+           (unsigned long long)hist.max);
+}
+
+//--- Заполненность групп: сколько групп с 0..8 занятыми слотами и сколько удаленных слотов
+static void stats(struct shm_hash *h) {
+    long fill[SHM_HASH_GROUP + 1] = { 0 }, tombs = 0;
+    uint32_t g;
+    int i, used;
+
+    for ( g = 0; g <= h->mask; g++ ) {
+        for ( used = 0, i = 0; i < SHM_HASH_GROUP; i++ ) {
+            used += h->groups[g].state[i] == SHM_HASH_USED;
+            tombs += h->groups[g].state[i] == SHM_HASH_TOMB;
+        }
+        fill[used]++;
+    }
+    printf("%llu keys in %u groups of %d slots, %ld deleted slots\n",
+           (unsigned long long)h->hdr->count, h->hdr->ngroups, SHM_HASH_GROUP, tombs);
+    for ( i = 0; i <= SHM_HASH_GROUP; i++ )
+        printf("groups with %d keys: %ld\n", i, fill[i]);
+}
+
+int main (int argc, char ** argv) {
+    int cmd, len;
+    long count = 0;
+    uint32_t capacity = SHM_KV_CAPACITY;
+    size_t size;
+    void *addr;
+    struct shm_hash table;
+    char val[SHM_HASH_VAL_MAX + 1];
+
+    //--- разбор командной строки
+    if ( argc < 2 ) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if ( !strcmp(argv[1], "create") ) {
+        if ( argc == 3 )
+            capacity = strtoul(argv[2], NULL, 0);
+        cmd = SHM_CREATE;
+    } else if ( !strcmp(argv[1], "put") && (argc == 4) ) {
+        cmd = SHM_PUT;
+    } else if ( !strcmp(argv[1], "get") && (argc == 3) ) {
+        cmd = SHM_GET;
+    } else if ( !strcmp(argv[1], "del") && (argc == 3) ) {
+        cmd = SHM_DEL;
+    } else if ( !strcmp(argv[1], "load") && (argc == 3) ) {
+        count = atol(argv[2]);
+        cmd = SHM_LOAD;
+    } else if ( !strcmp(argv[1], "bench") && (argc == 3) ) {
+        count = atol(argv[2]);
+        cmd = SHM_BENCH;
+    } else if ( !strcmp(argv[1], "stats") ) {
+        cmd = SHM_STATS;
+    } else if ( !strcmp(argv[1], "unlink") ) {
+        cmd = SHM_CLOSE;
+    } else {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if ( cmd == SHM_CLOSE ) {
+        if ( shm_unlink(SHM_KV_NAME) == -1 )
+            perror("shm_unlink");
+        return 0;
+    }
+
+    //--- таблица целиком лежит в сегменте, страницы выделяем сразу, чтобы поиски не ловили page fault
+    size = shm_hash_size(capacity);
+    if ( (addr = shm_segment_map(SHM_KV_NAME, &size, cmd == SHM_CREATE, SHM_SEG_POPULATE)) == NULL )
+        return 1;
+    if ( cmd == SHM_CREATE )
+        shm_hash_init(addr, capacity);
+    if ( shm_hash_attach(&table, addr) == -1 ) {
+        printf("%s is not a hash table, run '%s create' first\n", SHM_KV_NAME, argv[0]);
+        return 1;
+    }
+
+    switch ( cmd ) {
+    case SHM_CREATE:
+        printf("Hash table for %u keys created (%u groups, %zu bytes).\n", capacity, table.hdr->ngroups, size);
+        break;
+    case SHM_PUT:
+        if ( shm_hash_put(&table, argv[2], strlen(argv[2]), argv[3], strlen(argv[3])) == -1 )
+            printf("Key or value is too long (max %d/%d) or table is full\n", SHM_HASH_KEY_MAX, SHM_HASH_VAL_MAX);
+        break;
+    case SHM_GET:
+        if ( (len = shm_hash_get(&table, argv[2], strlen(argv[2]), val, SHM_HASH_VAL_MAX)) < 0 ) {
+            printf("%s: not found\n", argv[2]);
+            break;
+        }
+        val[len] = '\0';
+        printf("%s = %s\n", argv[2], val);
+        break;
+    case SHM_DEL:
+        if ( shm_hash_del(&table, argv[2], strlen(argv[2])) == -1 )
+            printf("%s: not found\n", argv[2]);
+        break;
+    case SHM_LOAD:
+        load(&table, count);
+        break;
+    case SHM_BENCH:
+        bench(&table, count);
+        break;
+    case SHM_STATS:
+        stats(&table);
+        break;
+    }
+
+    shm_segment_close(addr, size);
+    return 0;
+}
+
+/*
+Хеш-таблица в разделяемой памяти
+
+Сегмент из shm.c хранит одну строку, поэтому процессы, которым нужен общий кэш
+"ключ - значение", держат каждый свою копию или ходят за данными через канал.
+Здесь таблица целиком лежит в разделяемой памяти (shm_hash.h), и любой процесс
+ищет в ней ключ сам, без системных вызовов:
+
+    - открытая адресация: слоты собраны в группы по 8, ключ живет в своей домашней
+      группе, а если она заполнена - в следующей;
+    - первая строка кэша группы хранит seqlock и 32-битные хеши всех 8 ключей,
+      поэтому поиск читает одну строку заголовка и еще одну - только у совпавшего слота;
+    - у каждой группы свой seqlock: поиск ничего не пишет в общую память и просто
+      перечитывает группу, если ее в это время меняли; писатели блокируют только
+      свою группу, т.е. замок "расщеплен" на столько частей, сколько групп.
+
+Ключи и значения фиксированной длины (до 30 и 32 байт): весь слот - одна строка кэша.
+Удаленный ключ оставляет в слоте метку, слот переиспользуется, но поиск через него
+идет дальше; если удалений очень много, таблицу стоит пересоздать.
+
+Компилируем:
+
+$ g++ -O2 -o shm_kv shm_kv.c -pthread -lrt
+
+$ ./shm_kv create 1000000
+Hash table for 1000000 keys created (262144 groups, 150994944 bytes).
+$ ./shm_kv put user:42 'Vasya Pupkin'
+$ ./shm_kv get user:42
+user:42 = Vasya Pupkin
+$ ./shm_kv load 1000000
+
+Поиски из нескольких процессов сразу:
+
+$ ./shm_kv bench 10000000 & ./shm_kv bench 10000000 & wait
+[20511] 10000000 lookups in 2.913 s, 0 misses, mean 271 ns, p50 240 ns, p99 560 ns, p99.9 1248 ns, max 40213 ns
+...
+$ ./shm_kv stats
+$ ./shm_kv unlink
+*/
@@ -0,0 +1,105 @@
+#ifndef SHM_SEGMENT_H
+#define SHM_SEGMENT_H
+
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h> /* For mode constants */
+#include <sys/vfs.h>
+#include <fcntl.h>
+#include <stdio.h>
+
+//--- Флаги отображения сегмента
+#define SHM_SEG_POPULATE 0x01 // MAP_POPULATE: все страницы выделяются сразу в mmap()
+#define SHM_SEG_WILLNEED 0x02 // madvise(MADV_WILLNEED): подсказка ядру подгрузить страницы заранее
+#define SHM_SEG_MLOCK    0x04 // mlock(): страницы закреплены в памяти и не уходят в swap
+#define SHM_SEG_THP      0x08 // madvise(MADV_HUGEPAGE): прозрачные большие страницы (shmem_enabled=advise)
+#define SHM_SEG_HUGETLB  0x10 // файл на hugetlbfs: явные большие страницы из пула vm.nr_hugepages
+
+#define SHM_HUGETLBFS_DIR "/dev/hugepages"
+
+//--- Открывает объект: обычный - через shm_open() (он лежит в /dev/shm),
+//--- с SHM_SEG_HUGETLB - файл с тем же именем на смонтированной hugetlbfs.
+static inline int shm_segment_fd(const char *name, int create, int flags, char *path, size_t path_size) {
+    if ( !(flags & SHM_SEG_HUGETLB) )
+        return shm_open(name, (create ? O_CREAT : 0)|O_RDWR, S_IRWXO|S_IRWXG|S_IRWXU);
+
+    snprintf(path, path_size, "%s/%s", SHM_HUGETLBFS_DIR, name[0] == '/' ? name + 1 : name);
+    return open(path, (create ? O_CREAT : 0)|O_RDWR, S_IRWXO|S_IRWXG|S_IRWXU);
+}
+
+//--- Открывает разделяемую память с именем name и отображает ее в память процесса.
+//--- create != 0 : объект создается (если его еще нет) и увеличивается до размера *size,
+//---               для hugetlbfs - с округлением вверх до размера большой страницы.
+//---               Существующий объект большего размера не уменьшается.
+//--- create == 0 : подключаемся к существующему объекту.
+//--- В *size возвращается итоговый размер объекта.
+//--- flags - SHM_SEG_*. Возвращает адрес начала памяти или NULL в случае ошибки.
+static inline void *shm_segment_map(const char *name, size_t *size, int create, int flags) {
+    int shm;
+    struct stat st;
+    struct statfs sfs;
+    char path[256];
+    void *addr;
+
+    if ( (shm = shm_segment_fd(name, create, flags, path, sizeof(path))) == -1 ) {
+        perror((flags & SHM_SEG_HUGETLB) ? path : "shm_open");
+        return NULL;
+    }
+
+    if ( fstat(shm, &st) == -1 ) {
+        perror("fstat");
+        close(shm);
+        return NULL;
+    }
+
+    if ( create && (size_t)st.st_size < *size ) {
+        //--- на hugetlbfs размер блока файловой системы - это размер большой страницы
+        if ( (flags & SHM_SEG_HUGETLB) && fstatfs(shm, &sfs) == 0 && sfs.f_bsize > 0 )
+            *size = (*size + sfs.f_bsize - 1) / sfs.f_bsize * sfs.f_bsize;
+        if ( ftruncate(shm, *size) == -1 ) {
+            perror("ftruncate");
+            close(shm);
+            return NULL;
+        }
+    } else {
+        *size = st.st_size;
+    }
+
+    addr = mmap(0, *size, PROT_WRITE|PROT_READ,
+                MAP_SHARED|((flags & SHM_SEG_POPULATE) ? MAP_POPULATE : 0), shm, 0);
+    close(shm); // отображение остается действительным и после закрытия дескриптора
+    if ( addr == MAP_FAILED ) {
+        perror("mmap");
+        return NULL;
+    }
+
+    //--- ошибки подсказок не фатальны: сегмент работает и без них
+    if ( (flags & SHM_SEG_THP) && madvise(addr, *size, MADV_HUGEPAGE) == -1 )
+        perror("madvise(MADV_HUGEPAGE)");
+    if ( (flags & SHM_SEG_WILLNEED) && madvise(addr, *size, MADV_WILLNEED) == -1 )
+        perror("madvise(MADV_WILLNEED)");
+    if ( (flags & SHM_SEG_MLOCK) && mlock(addr, *size) == -1 )
+        perror("mlock");
+    return addr;
+}
+
+static inline void *shm_segment_open(const char *name, size_t *size, int create) {
+    return shm_segment_map(name, size, create, 0);
+}
+
+static inline void shm_segment_close(void *addr, size_t size) {
+    munmap(addr, size);
+}
+
+static inline int shm_segment_unlink(const char *name, int flags) {
+    char path[256];
+
+    if ( !(flags & SHM_SEG_HUGETLB) )
+        return shm_unlink(name);
+    snprintf(path, sizeof(path), "%s/%s", SHM_HUGETLBFS_DIR, name[0] == '/' ? name + 1 : name);
+    return unlink(path);
+}
+
+#endif
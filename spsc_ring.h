@@ -0,0 +1,213 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include "ipc_common.h"
+#include "futex_wait.h"
+
+//--- Кольцевой буфер "один писатель - один читатель" (single producer / single consumer)
+//--- в разделяемой памяти. Обмен идет без системных вызовов: только атомарные
+//--- load-acquire / store-release индексов head и tail.
+
+#define SPSC_RING_MAGIC     0x53505343 // "SPSC"
+#define SPSC_RING_SLOT_SIZE CACHE_LINE_SIZE
+#define SPSC_RING_MSG_MAX   (SPSC_RING_SLOT_SIZE - sizeof(uint32_t))
+
+struct spsc_slot {
+    uint32_t len;
+    char     data[SPSC_RING_MSG_MAX];
+};
+
+//--- Заголовок, лежащий в начале разделяемой памяти.
+//--- head пишет только производитель, tail - только потребитель,
+//--- поэтому они разнесены по разным строкам кэша.
+struct spsc_ring_hdr {
+    uint32_t magic;
+    uint32_t capacity; // число ячеек, степень двойки
+    uint64_t head CACHE_ALIGNED;
+    uint64_t tail CACHE_ALIGNED;
+    struct shm_event not_empty CACHE_ALIGNED; // на нем спит потребитель
+    struct shm_event not_full  CACHE_ALIGNED; // на нем спит производитель
+} CACHE_ALIGNED;
+
+//--- Локальное (в памяти процесса) состояние одной стороны канала.
+//--- cached_* - последнее увиденное значение чужого индекса: пока в кольце есть
+//--- место/данные, мы не трогаем строку кэша другой стороны.
+struct spsc_ring {
+    struct spsc_ring_hdr *hdr;
+    struct spsc_slot     *slots;
+    uint32_t              mask;
+    uint64_t              head;        // производитель: своя копия head
+    uint64_t              cached_tail; // производитель: последний прочитанный tail
+    uint64_t              tail;        // потребитель: своя копия tail
+    uint64_t              cached_head; // потребитель: последний прочитанный head
+};
+
+static inline int spsc_ring_is_pow2(uint32_t n) {
+    return n && !(n & (n - 1));
+}
+
+//--- Размер разделяемой памяти под кольцо из capacity ячеек
+static inline size_t spsc_ring_size(uint32_t capacity) {
+    return sizeof(struct spsc_ring_hdr) + (size_t)capacity * sizeof(struct spsc_slot);
+}
+
+//--- Разметка свежей памяти. Вызывается один раз создателем сегмента.
+static inline int spsc_ring_init(void *mem, uint32_t capacity) {
+    struct spsc_ring_hdr *hdr = (struct spsc_ring_hdr *)mem;
+
+    if ( !spsc_ring_is_pow2(capacity) )
+        return -1;
+    hdr->capacity = capacity;
+    hdr->head = 0;
+    hdr->tail = 0;
+    shm_event_init(&hdr->not_empty);
+    shm_event_init(&hdr->not_full);
+    __atomic_store_n(&hdr->magic, SPSC_RING_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+//--- Подключение к уже размеченному кольцу (из любого процесса)
+static inline int spsc_ring_attach(struct spsc_ring *r, void *mem) {
+    r->hdr = (struct spsc_ring_hdr *)mem;
+    if ( __atomic_load_n(&r->hdr->magic, __ATOMIC_ACQUIRE) != SPSC_RING_MAGIC )
+        return -1;
+    r->slots = (struct spsc_slot *)(r->hdr + 1);
+    r->mask = r->hdr->capacity - 1;
+    r->head = r->cached_head = __atomic_load_n(&r->hdr->head, __ATOMIC_ACQUIRE);
+    r->tail = r->cached_tail = __atomic_load_n(&r->hdr->tail, __ATOMIC_ACQUIRE);
+    return 0;
+}
+
+//--- Производитель: кладет сообщение. Возвращает 0 или -1: errno = EAGAIN, если кольцо
+//--- заполнено, EMSGSIZE, если сообщение длиннее SPSC_RING_MSG_MAX и не помещается в слот.
+static inline int spsc_ring_push(struct spsc_ring *r, const void *data, uint32_t len) {
+    struct spsc_slot *slot;
+
+    if ( len > SPSC_RING_MSG_MAX ) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if ( r->head - r->cached_tail > r->mask ) {
+        r->cached_tail = __atomic_load_n(&r->hdr->tail, __ATOMIC_ACQUIRE);
+        if ( r->head - r->cached_tail > r->mask ) {
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+
+    slot = &r->slots[r->head & r->mask];
+    slot->len = len;
+    memcpy(slot->data, data, len);
+    __atomic_store_n(&r->hdr->head, ++r->head, __ATOMIC_RELEASE);
+    return 0;
+}
+
+//--- Потребитель: забирает сообщение в buf (не более size байт).
+//--- Возвращает длину сообщения или -1, если кольцо пусто.
+static inline int spsc_ring_pop(struct spsc_ring *r, void *buf, uint32_t size) {
+    struct spsc_slot *slot;
+    uint32_t len;
+
+    if ( r->tail == r->cached_head ) {
+        r->cached_head = __atomic_load_n(&r->hdr->head, __ATOMIC_ACQUIRE);
+        if ( r->tail == r->cached_head )
+            return -1;
+    }
+
+    slot = &r->slots[r->tail & r->mask];
+    len = (slot->len <= size) ? slot->len : size;
+    memcpy(buf, slot->data, len);
+    __atomic_store_n(&r->hdr->tail, ++r->tail, __ATOMIC_RELEASE);
+    return len;
+}
+
+//--- Блокирующие варианты: сначала недолго крутимся, затем засыпаем на futex.
+//--- Если одна сторона пользуется spsc_ring_send/recv, другая тоже должна,
+//--- иначе ее никто не разбудит. spsc_ring_send возвращает -1 (EMSGSIZE) только
+//--- для слишком длинного сообщения: ждать места для него бесполезно.
+static inline int spsc_ring_send(struct spsc_ring *r, const void *data, uint32_t len) {
+    int spin = SHM_EVENT_SPIN;
+    uint32_t seq;
+
+    if ( len > SPSC_RING_MSG_MAX ) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    while ( spsc_ring_push(r, data, len) == -1 ) {
+        if ( spin-- > 0 ) {
+            cpu_relax();
+            continue;
+        }
+        seq = shm_event_prepare_wait(&r->hdr->not_full);
+        if ( spsc_ring_push(r, data, len) == 0 ) {
+            shm_event_cancel_wait(&r->hdr->not_full);
+            break;
+        }
+        shm_event_wait(&r->hdr->not_full, seq);
+    }
+    shm_event_notify(&r->hdr->not_empty);
+    return 0;
+}
+
+static inline int spsc_ring_recv(struct spsc_ring *r, void *buf, uint32_t size) {
+    int spin = SHM_EVENT_SPIN;
+    int len;
+    uint32_t seq;
+
+    while ( (len = spsc_ring_pop(r, buf, size)) == -1 ) {
+        if ( spin-- > 0 ) {
+            cpu_relax();
+            continue;
+        }
+        seq = shm_event_prepare_wait(&r->hdr->not_empty);
+        if ( (len = spsc_ring_pop(r, buf, size)) >= 0 ) {
+            shm_event_cancel_wait(&r->hdr->not_empty);
+            break;
+        }
+        shm_event_wait(&r->hdr->not_empty, seq);
+    }
+    shm_event_notify(&r->hdr->not_full);
+    return len;
+}
+
+struct spsc_ring_pop_arg {
+    struct spsc_ring *r;
+    void             *buf;
+    uint32_t          size;
+    int               len;
+};
+
+static inline int spsc_ring_pop_ready(void *p) {
+    struct spsc_ring_pop_arg *a = (struct spsc_ring_pop_arg *)p;
+
+    return (a->len = spsc_ring_pop(a->r, a->buf, a->size)) >= 0;
+}
+
+//--- Потребитель в режиме опроса (shm_poll_wait): крутится на head с бюджетом,
+//--- затем с растущими паузами и только потом засыпает на not_empty.
+//--- Производитель - обычный spsc_ring_send().
+static inline int spsc_ring_recv_poll(struct spsc_ring *r, void *buf, uint32_t size, struct shm_poll *poll) {
+    struct spsc_ring_pop_arg a = { r, buf, size, -1 };
+    uint32_t seq;
+
+    if ( !shm_poll_wait(poll, spsc_ring_pop_ready, &a) ) {
+        shm_poll_parked(poll);
+        for ( ;; ) {
+            seq = shm_event_prepare_wait(&r->hdr->not_empty);
+            if ( spsc_ring_pop_ready(&a) ) {
+                shm_event_cancel_wait(&r->hdr->not_empty);
+                break;
+            }
+            shm_event_wait(&r->hdr->not_empty, seq);
+            if ( spsc_ring_pop_ready(&a) )
+                break;
+        }
+    }
+    shm_event_notify(&r->hdr->not_full);
+    return a.len;
+}
+
+#endif
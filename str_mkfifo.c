@@ -1,15 +1,289 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // splice(), vmsplice(), tee(), F_SETPIPE_SZ
+#endif
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include "ipc_common.h"
+#include "fifo_frame.h"
+#include "async_log.h"
+#include "work_pool.h"
 
 #define NAMEDPIPE_NAME "/tmp/my_named_pp"
 #define BUFSIZE        50
+#define PIPE_SIZE      (1024 * 1024) // желаемый размер буфера канала для splice
+#define WORK_ROUNDS    200           // сколько раз обработчик пула прогоняет сообщение через хеш
+
+#define MODE_TEXT   0
+#define MODE_FRAMED 1
+#define MODE_SPLICE 2
+#define MODE_POOL   3
+
+void usage(const char * s) {
+    printf("Usage: %s [framed [-v] [-a] | pool threads [ordered] [-v] [-a] | send 'text' [count] | splice dest [copy_fifo] | vsend file]\n", s);
+}
+
+//--- Печать кадра с -v: через async_log_printf(), т.е. фоновым потоком, если журнал запущен
+void print_frame(const char *data, uint32_t len, void *arg) {
+    async_log_printf("Incomming message (%u): %.*s\n", len, (int)len, data);
+}
+
+//--- Читатель кадрированного потока (fifo_frame_drain); итог - после того, как журнал допечатан
+int read_frames(int fd, int verbose) {
+    struct fifo_frame_stats st = { 0, 0, verbose, print_frame };
+    uint64_t ns;
+    ssize_t len = fifo_frame_drain(fd, &st, &ns);
+
+    async_log_stop();
+    printf("Received %ld messages, %ld bytes in %.3f s\n", st.frames, st.bytes, ns / 1e9);
+    return len < 0;
+}
+
+//--- Ключ сообщения для режима с порядком: все до первого ':' (имя производителя),
+//--- а если ':' нет - сообщение целиком
+static uint64_t message_key(const char *data, uint32_t len) {
+    uint64_t h = 14695981039346656037ULL; // FNV-1a
+    uint32_t i;
+
+    for ( i = 0; i < len && data[i] != ':'; i++ )
+        h = (h ^ (unsigned char)data[i]) * 1099511628211ULL;
+    return h;
+}
+
+//--- Обработчик пула: имитирует тяжелую обработку сообщения. Вызывается рабочими потоками.
+void on_work(const char *data, uint32_t len, void *arg) {
+    struct fifo_frame_stats *st = (struct fifo_frame_stats *)arg;
+    uint64_t h = 0;
+    uint32_t i;
+    int r;
+
+    for ( r = 0; r < WORK_ROUNDS; r++ )
+        for ( i = 0; i < len; i++ )
+            h = (h ^ (unsigned char)data[i]) * 1099511628211ULL + r;
+    __atomic_fetch_add(&st->frames, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&st->bytes, len, __ATOMIC_RELAXED);
+    if ( st->verbose )
+        async_log_printf("Processed message (%u, %016llx): %.*s\n", len, (unsigned long long)h, (int)len, data);
+}
+
+//--- Поток чтения в режиме пула только выделяет кадры и раздает их рабочим
+void on_pool_frame(const char *data, uint32_t len, void *arg) {
+    struct work_pool *pool = (struct work_pool *)arg;
+
+    if ( work_pool_submit(pool, data, len, message_key(data, len)) == -1 )
+        perror("malloc");
+}
+
+//--- Читатель с пулом рабочих (work_pool.h): сам только режет поток на кадры
+int pool_frames(int fd, int nworkers, int flags, int verbose) {
+    static struct fifo_frame_reader reader;
+    static struct work_pool pool;
+    struct fifo_frame_stats st = { 0, 0, verbose, NULL };
+    ssize_t len;
+    uint64_t start = 0, ns;
+    int i;
+
+    if ( work_pool_start(&pool, nworkers, flags, on_work, &st) == -1 ) {
+        work_pool_stop(&pool);
+        work_pool_free(&pool);
+        return 1;
+    }
+    fifo_frame_reader_init(&reader);
+    while ( (len = fifo_frame_read(fd, &reader, on_pool_frame, &pool)) > 0 ) {
+        if ( !start )
+            start = now_ns();
+    }
+    if ( len < 0 )
+        perror("read");
+    //--- все прочитанное должно быть обработано до итогов
+    work_pool_stop(&pool);
+    ns = now_ns() - start;
+    async_log_stop();
+    printf("Processed %ld messages, %ld bytes in %.3f s by %d workers%s\n", st.frames, st.bytes,
+           start ? ns / 1e9 : 0.0, nworkers, (flags & WORK_POOL_ORDERED) ? " (ordered)" : "");
+    for ( i = 0; i < nworkers; i++ )
+        printf("  worker %d: %llu done, %llu stolen\n", i,
+               (unsigned long long)pool.workers[i].done, (unsigned long long)pool.workers[i].stolen);
+    printf("  reader waited for free deque slots %llu times\n", (unsigned long long)pool.full);
+    work_pool_free(&pool);
+    return len < 0;
+}
+
+//--- Производитель: отображает файл в память (страницы выровнены по границе страницы)
+//--- и передает в канал ссылки на эти страницы через vmsplice(), без копирования в буфер канала.
+//--- Страницы нельзя менять, пока читатель их не забрал, поэтому файл отображается только на чтение.
+int vsend_file(const char *path) {
+    int in, fd;
+    struct stat st;
+    struct iovec iov;
+    char *addr;
+    size_t off = 0;
+    ssize_t n;
+
+    if ( (in = open(path, O_RDONLY)) == -1 || fstat(in, &st) == -1 ) {
+        perror(path);
+        if ( in != -1 )
+            close(in);
+        return 1;
+    }
+    //--- пустой файл отобразить нельзя (mmap() длины 0 - EINVAL), а передавать нечего:
+    //--- только открываем и закрываем канал, чтобы читатель получил конец файла
+    if ( st.st_size == 0 ) {
+        close(in);
+        if ( (fd = open(NAMEDPIPE_NAME, O_WRONLY)) == -1 ) {
+            perror("open");
+            return 1;
+        }
+        close(fd);
+        return 0;
+    }
+    addr = (char *)mmap(0, st.st_size, PROT_READ, MAP_PRIVATE|MAP_POPULATE, in, 0);
+    close(in);
+    if ( addr == (char *)MAP_FAILED ) {
+        perror("mmap");
+        return 1;
+    }
+
+    if ( (fd = open(NAMEDPIPE_NAME, O_WRONLY)) == -1 ) {
+        perror("open");
+        munmap(addr, st.st_size);
+        return 1;
+    }
+    fcntl(fd, F_SETPIPE_SZ, PIPE_SIZE);
+
+    while ( off < (size_t)st.st_size ) {
+        iov.iov_base = addr + off;
+        iov.iov_len = ((size_t)st.st_size - off < PIPE_SIZE) ? (size_t)st.st_size - off : PIPE_SIZE;
+        if ( (n = vmsplice(fd, &iov, 1, 0)) == -1 ) {
+            perror("vmsplice");
+            break;
+        }
+        off += n;
+    }
+
+    close(fd);
+    munmap(addr, st.st_size);
+    return off != (size_t)st.st_size;
+}
+
+//--- Открывает получателя для splice_fifo():
+//--- 'unix:/path' - потоковый UNIX-сокет, иначе файл или существующий канал.
+int open_dest(const char *dest) {
+    int out;
+    struct sockaddr_un addr;
+
+    if ( !strncmp(dest, "unix:", 5) ) {
+        if ( (out = socket(AF_UNIX, SOCK_STREAM, 0)) == -1 ) {
+            perror("socket");
+            return -1;
+        }
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, dest + 5, sizeof(addr.sun_path) - 1);
+        if ( connect(out, (struct sockaddr *)&addr, sizeof(addr)) == -1 ) {
+            perror("connect");
+            close(out);
+            return -1;
+        }
+        return out;
+    }
+
+    if ( (out = open(dest, O_WRONLY|O_CREAT|O_TRUNC, 0666)) == -1 )
+        perror("open");
+    return out;
+}
+
+//--- Переносит ровно len байт из канала fd в out
+ssize_t splice_all(int fd, int out, size_t len) {
+    size_t moved = 0;
+    ssize_t n;
+
+    while ( moved < len ) {
+        if ( (n = splice(fd, NULL, out, NULL, len - moved, SPLICE_F_MOVE|SPLICE_F_MORE)) <= 0 )
+            return -1;
+        moved += n;
+    }
+    return moved;
+}
+
+//--- Читатель без промежуточного буфера: данные уходят из канала в dest через splice().
+//--- Если задан copy (другой канал), те же данные сначала дублируются в него через tee(),
+//--- который копирует лишь ссылки на страницы буфера канала.
+int splice_fifo(int fd, const char *dest, const char *copy) {
+    int out, dup_fd = -1;
+    ssize_t len;
+    long total = 0;
+    uint64_t start, ns;
+
+    if ( (out = open_dest(dest)) == -1 )
+        return 1;
+    if ( copy && (dup_fd = open(copy, O_WRONLY)) == -1 ) {
+        perror("open copy");
+        return 1;
+    }
+
+    start = now_ns();
+    for ( ;; ) {
+        if ( dup_fd != -1 ) {
+            if ( (len = tee(fd, dup_fd, PIPE_SIZE, 0)) <= 0 )
+                break;
+            if ( splice_all(fd, out, len) != len )
+                len = -1;
+        } else {
+            len = splice(fd, NULL, out, NULL, PIPE_SIZE, SPLICE_F_MOVE|SPLICE_F_MORE);
+        }
+        if ( len <= 0 )
+            break;
+        total += len;
+    }
+    if ( len < 0 )
+        perror("splice");
+    ns = now_ns() - start;
+    printf("Spliced %ld bytes in %.3f s (%.1f MiB/s)\n", total, ns / 1e9, total / 1048576.0 * 1e9 / (ns ? ns : 1));
+
+    if ( dup_fd != -1 )
+        close(dup_fd);
+    close(out);
+    return len < 0;
+}
 
 int main (int argc, char ** argv) {
-    int fd, len;
+    int fd, len, rc;
+    int mode = MODE_TEXT, verbose = 0, async = 0, nworkers = 0, flags = 0, i;
     char buf[BUFSIZE];
 
+    if ( argc >= 3 && argc <= 4 && !strcmp(argv[1], "send") ) {
+        return fifo_frame_send(NAMEDPIPE_NAME, argv[2], argc == 4 ? atol(argv[3]) : 1);
+    } else if ( argc == 3 && !strcmp(argv[1], "vsend") ) {
+        return vsend_file(argv[2]);
+    } else if ( argc >= 2 && !strcmp(argv[1], "framed") ) {
+        mode = MODE_FRAMED;
+        for ( i = 2; i < argc; i++ ) {
+            verbose |= !strcmp(argv[i], "-v");
+            async |= !strcmp(argv[i], "-a");
+        }
+    } else if ( argc >= 3 && !strcmp(argv[1], "pool") && (nworkers = atoi(argv[2])) >= 1 && nworkers <= WORK_POOL_MAX ) {
+        mode = MODE_POOL;
+        for ( i = 3; i < argc; i++ ) {
+            verbose |= !strcmp(argv[i], "-v");
+            async |= !strcmp(argv[i], "-a");
+            if ( !strcmp(argv[i], "ordered") )
+                flags |= WORK_POOL_ORDERED;
+        }
+    } else if ( argc >= 3 && argc <= 4 && !strcmp(argv[1], "splice") ) {
+        mode = MODE_SPLICE;
+    } else if ( argc != 1 ) {
+        usage(argv[0]);
+        return 1;
+    }
+
     if ( mkfifo(NAMEDPIPE_NAME, 0777) ) {
         perror("str_mkfifo");
         return 1;
@@ -22,6 +296,25 @@ int main (int argc, char ** argv) {
     }
     printf("%s is opened\n", NAMEDPIPE_NAME);
 
+    if ( mode == MODE_SPLICE ) {
+        //--- чем больше буфер канала, тем больше страниц переносит один splice()
+        fcntl(fd, F_SETPIPE_SZ, PIPE_SIZE);
+        rc = splice_fifo(fd, argv[2], argc == 4 ? argv[3] : NULL);
+        close(fd);
+        remove(NAMEDPIPE_NAME);
+        return rc;
+    }
+
+    if ( mode == MODE_FRAMED || mode == MODE_POOL ) {
+        //--- с -a сообщения печатает фоновый поток, а не цикл чтения
+        if ( async && async_log_start(STDOUT_FILENO) == -1 )
+            return 1;
+        rc = mode == MODE_FRAMED ? read_frames(fd, verbose) : pool_frames(fd, nworkers, flags, verbose);
+        close(fd);
+        remove(NAMEDPIPE_NAME);
+        return rc;
+    }
+
     do {
         memset(buf, '\0', BUFSIZE);
         
@@ -178,6 +471,84 @@ $ ./mkfifo
 Incomming message (22): Hello, my named pipe!
 read: Success
 
+Кадрированный поток
+
+Обычный читатель забирает из канала не больше BUFSIZE-1 = 49 байт за раз,
+поэтому сообщения режутся или склеиваются по случайным границам.
+В режиме framed каждое сообщение предваряется заголовком fifo_frame_hdr с его длиной
+(см. fifo_frame.h). Читатель одним read() забирает до 64 КиБ и разбирает
+все полные кадры прямо в буфере, без memset() и printf() на каждый кусок.
+Кадры не длиннее PIPE_BUF пишутся атомарно, поэтому писателей может быть несколько.
+
+$ ./str_mkfifo framed
+/tmp/my_named_pp is created
+/tmp/my_named_pp is opened
+Received 1000000 messages, 22000000 bytes in 0.412 s
+
+В соседнем терминальном окне:
+
+$ ./str_mkfifo send 'Hello, my named pipe!' 1000000
+
+С ключом -v читатель печатает каждое сообщение:
+
+$ ./str_mkfifo framed -v
+
+printf() на каждое сообщение быстро становится самым медленным местом цикла чтения.
+С ключом -a сообщения только копируются в буфер асинхронного журнала (async_log.h),
+а выводит их фоновый поток пачками через writev():
+
+$ ./str_mkfifo framed -v -a > messages.log
+
+Пул рабочих потоков
+
+Если обработка сообщения дороже его чтения, одно ядро не успевает за каналом.
+В режиме pool поток чтения только выделяет кадры, копирует каждое сообщение
+и кладет его в дек одного из рабочих по кругу (work_pool.h). Рабочий берет
+сообщения из своего дека, а когда тот пуст - крадет из деков соседей, поэтому
+медленное сообщение у одного рабочего не задерживает остальные. Обработчик
+on_work() имитирует тяжелую работу: WORK_ROUNDS проходов хеша по сообщению.
+
+$ ./str_mkfifo pool 4
+/tmp/my_named_pp is created
+/tmp/my_named_pp is opened
+Processed 1000000 messages, 22000000 bytes in 1.310 s by 4 workers
+  worker 0: 251234 done, 1022 stolen
+  ...
+
+Без ordered сообщения одного производителя могут обработаться в любом порядке.
+С ordered ключ сообщения (все до первого ':', например 'sensor1:...') выбирает
+одну из WORK_POOL_STRANDS нитей - очередей, которые в каждый момент обрабатывает
+только один рабочий. Крадутся целые нити, поэтому сообщения с одним ключом
+обрабатываются строго в порядке чтения, а разные ключи - параллельно.
+
+$ ./str_mkfifo pool 4 ordered -v > processed.log
+
+С -a строки разных рабочих попадают в журнал пачками по потокам (async_log.h),
+поэтому в processed.log порядок внутри ключа виден только без -a.
+
+В соседних терминальных окнах:
+
+$ ./str_mkfifo send 'sensor1:Hello, my named pipe!' 1000000
+$ ./str_mkfifo send 'sensor2:Hello, my named pipe!' 1000000
+
+Перенос без копирования: splice(), tee(), vmsplice()
+
+Для больших объемов данных копирование из канала в buf[] и обратно в файл - лишняя работа.
+Канал - это набор страниц в ядре, и их можно передавать дальше, не копируя:
+
+    splice(in, out) - переносит страницы из канала в файл, сокет или другой канал;
+    tee(in, out)    - дублирует данные канала в другой канал, не забирая их из in;
+    vmsplice(fd)    - отдает в канал страницы пользовательской памяти.
+
+Для vmsplice() страницы должны быть выровнены, поэтому писатель отображает файл
+через mmap() и не трогает эти страницы, пока читатель их не заберет.
+Буфер канала увеличивается до 1 МиБ через fcntl(F_SETPIPE_SZ).
+
+$ ./str_mkfifo splice /tmp/out.bin                 <-- в файл
+$ ./str_mkfifo splice unix:/tmp/consumer.sock      <-- в UNIX-сокет
+$ ./str_mkfifo splice /tmp/out.bin /tmp/copy_fifo  <-- в файл и копия в другой канал
 
+В соседнем терминальном окне:
 
+$ ./str_mkfifo vsend /tmp/big.bin
 */
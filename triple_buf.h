@@ -0,0 +1,96 @@
+#ifndef TRIPLE_BUF_H
+#define TRIPLE_BUF_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "ipc_common.h"
+
+//--- Тройной буфер: публикация последнего значения "один писатель - один читатель".
+//--- Три слота: задний пишет писатель, передний читает читатель, средний - последний
+//--- опубликованный. Публикация и взятие нового значения - по одному атомарному обмену
+//--- номера слота в слове state, поэтому ни писатель, ни читатель не ждут друг друга
+//--- и не повторяют чтение, как в seqlock. Данные не копируются: писатель собирает
+//--- значение прямо в заднем слоте, читатель работает прямо с передним.
+//--- Промежуточные значения, которые читатель не успел взять, теряются - это и нужно
+//--- читателю, которому важно только последнее состояние.
+//---
+//--- Все лежит в разделяемой памяти: back меняет только писатель, front - только читатель,
+//--- поэтому писатель и читатель могут перезапускаться, не теряя свои слоты.
+
+#define TRIPLE_BUF_MAGIC 0x42505254 // "TRPB"
+#define TRIPLE_BUF_FRESH 0x4        // в среднем слоте значение, которого читатель еще не видел
+#define TRIPLE_BUF_INDEX 0x3
+
+struct triple_buf {
+    uint32_t magic;
+    uint32_t slot_size;
+    uint32_t state CACHE_ALIGNED; // номер среднего слота | TRIPLE_BUF_FRESH
+    uint32_t back  CACHE_ALIGNED; // слот писателя
+    uint64_t published;           // сколько значений опубликовано
+    uint32_t front CACHE_ALIGNED; // слот читателя
+    uint64_t taken;               // сколько значений взял читатель
+} CACHE_ALIGNED;
+
+//--- Размечает size байт памяти mem: заголовок и три слота поровну. Возвращает размер слота
+//--- или 0, если память слишком мала.
+static inline size_t triple_buf_init(void *mem, size_t size) {
+    struct triple_buf *tb = (struct triple_buf *)mem;
+    size_t slot;
+
+    if ( size < sizeof(*tb) + 3 * CACHE_LINE_SIZE )
+        return 0;
+    slot = (size - sizeof(*tb)) / 3 / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+    if ( slot > UINT32_MAX )
+        slot = (size_t)UINT32_MAX / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+    tb->slot_size = slot;
+    tb->back = 0;
+    tb->state = 1;
+    tb->front = 2;
+    tb->published = 0;
+    tb->taken = 0;
+    __atomic_store_n(&tb->magic, TRIPLE_BUF_MAGIC, __ATOMIC_RELEASE);
+    return slot;
+}
+
+static inline int triple_buf_valid(const struct triple_buf *tb, size_t size) {
+    return size >= sizeof(*tb) && __atomic_load_n(&tb->magic, __ATOMIC_ACQUIRE) == TRIPLE_BUF_MAGIC &&
+           sizeof(*tb) + 3 * (size_t)tb->slot_size <= size;
+}
+
+static inline char *triple_buf_slot(struct triple_buf *tb, uint32_t i) {
+    return (char *)tb + sizeof(*tb) + (size_t)i * tb->slot_size;
+}
+
+//--- Писатель: слот, в котором собирается следующее значение
+static inline char *triple_buf_back(struct triple_buf *tb) {
+    return triple_buf_slot(tb, tb->back);
+}
+
+//--- Писатель: задний слот становится средним, бывший средний - новым задним.
+//--- Если читатель не взял прошлое значение, оно просто заменяется новым.
+static inline void triple_buf_publish(struct triple_buf *tb) {
+    uint32_t old = __atomic_exchange_n(&tb->state, tb->back | TRIPLE_BUF_FRESH, __ATOMIC_ACQ_REL);
+
+    tb->back = old & TRIPLE_BUF_INDEX;
+    tb->published++;
+}
+
+//--- Читатель: если опубликовано новое значение, забирает средний слот себе в передние.
+//--- Возвращает 1, если передний слот сменился, 0 - нового значения нет.
+static inline int triple_buf_update(struct triple_buf *tb) {
+    uint32_t old;
+
+    if ( !(__atomic_load_n(&tb->state, __ATOMIC_RELAXED) & TRIPLE_BUF_FRESH) )
+        return 0;
+    old = __atomic_exchange_n(&tb->state, tb->front, __ATOMIC_ACQ_REL);
+    tb->front = old & TRIPLE_BUF_INDEX;
+    tb->taken++;
+    return 1;
+}
+
+//--- Читатель: последнее взятое значение
+static inline char *triple_buf_front(struct triple_buf *tb) {
+    return triple_buf_slot(tb, tb->front);
+}
+
+#endif
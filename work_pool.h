@@ -0,0 +1,290 @@
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include "ipc_common.h"
+#include "futex_wait.h"
+
+//--- Пул рабочих потоков с кражей работы для обработки сообщений.
+//--- Поток чтения только разбирает кадры, копирует сообщение и кладет его в дек
+//--- одного из рабочих (по кругу). Рабочий берет работу из своего дека, а когда тот
+//--- пуст - крадет из чужих. Очередь рабочего (work_deque) - кольцо "один писатель -
+//--- много читателей" (SPMC) в порядке FIFO: класть в нижний конец может только поток
+//--- чтения, а забирают из верхнего через CAS и сам рабочий, и воры, одинаково.
+//--- Это не дек Chase-Lev: у рабочего нет своего конца без CAS и LIFO-снятия последней
+//--- работы - работу в очередь кладет не он, а поток чтения.
+//---
+//--- С WORK_POOL_ORDERED сообщения с одним ключом обрабатываются строго по порядку:
+//--- ключ выбирает "нить" (strand) - очередь сообщений, которую в каждый момент
+//--- обрабатывает не больше одного рабочего. В деки попадают нити, а не сообщения,
+//--- и крадутся тоже нити, поэтому порядок внутри ключа не нарушается.
+
+#define WORK_POOL_MAX       64
+#define WORK_POOL_DEQUE     1024 // ячеек в деке рабочего, степень двойки
+#define WORK_POOL_STRANDS   256  // нитей в режиме с порядком
+#define WORK_POOL_STRAND_Q  256  // сообщений в очереди нити, степень двойки
+#define WORK_POOL_ORDERED   0x01
+
+struct work_msg {
+    uint32_t len;
+    char     data[];
+};
+
+typedef void (*work_fn)(const char *data, uint32_t len, void *arg);
+
+struct work_deque {
+    uint64_t top    CACHE_ALIGNED; // забирают владелец и воры (CAS)
+    uint64_t bottom CACHE_ALIGNED; // кладет только поток чтения
+    void    *items[WORK_POOL_DEQUE];
+};
+
+//--- Нить: кольцо "один писатель (поток чтения) - один читатель (текущий владелец нити)".
+//--- scheduled = 1, пока нить лежит в каком-то деке или ее обрабатывает рабочий.
+struct work_strand {
+    uint64_t         head CACHE_ALIGNED;
+    uint64_t         tail CACHE_ALIGNED;
+    uint32_t         scheduled;
+    struct work_msg *msgs[WORK_POOL_STRAND_Q];
+};
+
+struct work_pool;
+
+struct work_worker {
+    struct work_deque  deque;
+    struct work_pool  *pool;
+    int                id;
+    pthread_t          tid;
+    uint64_t           done   CACHE_ALIGNED; // обработано сообщений
+    uint64_t           stolen;               // взято работы из чужих деков
+};
+
+struct work_pool {
+    int                 nworkers;
+    int                 flags;
+    int                 next;     // поток чтения: в чей дек класть следующую работу
+    int                 stop;
+    work_fn             fn;
+    void               *arg;
+    uint64_t            full;     // сколько раз поток чтения ждал места
+    struct shm_event    work CACHE_ALIGNED; // на нем спят рабочие без работы
+    struct work_worker *workers;
+    struct work_strand *strands;
+};
+
+//--- Поток чтения: кладет в нижний конец. -1 - дек заполнен.
+static inline int work_deque_push(struct work_deque *d, void *item) {
+    uint64_t b = d->bottom;
+
+    if ( b - __atomic_load_n(&d->top, __ATOMIC_ACQUIRE) >= WORK_POOL_DEQUE )
+        return -1;
+    __atomic_store_n(&d->items[b & (WORK_POOL_DEQUE - 1)], item, __ATOMIC_RELAXED);
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+//--- Любой рабочий: забирает из верхнего конца (самую старую работу) или NULL
+static inline void *work_deque_take(struct work_deque *d) {
+    uint64_t t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE), b;
+    void *item;
+
+    for ( ;; ) {
+        b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+        if ( t >= b )
+            return NULL;
+        //--- ячейку t поток чтения не перезапишет, пока top не уйдет дальше t,
+        //--- а тогда наш CAS не пройдет
+        item = __atomic_load_n(&d->items[t & (WORK_POOL_DEQUE - 1)], __ATOMIC_RELAXED);
+        if ( __atomic_compare_exchange_n(&d->top, &t, t + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) )
+            return item;
+        //--- t обновлен CAS'ом - пробуем следующую
+    }
+}
+
+//--- Обрабатывает сообщения нити, пока она не опустеет, и снимает с нее отметку.
+//--- Если поток чтения успел добавить сообщение, нить снова наша и обработка продолжается.
+static inline uint64_t work_strand_run(struct work_pool *pool, struct work_strand *s) {
+    struct work_msg *m;
+    uint64_t n = 0;
+    uint32_t idle;
+
+    for ( ;; ) {
+        while ( s->tail != __atomic_load_n(&s->head, __ATOMIC_ACQUIRE) ) {
+            m = s->msgs[s->tail & (WORK_POOL_STRAND_Q - 1)];
+            pool->fn(m->data, m->len, pool->arg);
+            free(m);
+            __atomic_store_n(&s->tail, s->tail + 1, __ATOMIC_RELEASE);
+            n++;
+        }
+        __atomic_store_n(&s->scheduled, 0, __ATOMIC_RELEASE);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        idle = 0;
+        if ( s->tail == __atomic_load_n(&s->head, __ATOMIC_ACQUIRE) ||
+             !__atomic_compare_exchange_n(&s->scheduled, &idle, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED) )
+            return n;
+    }
+}
+
+//--- Сначала свой дек, потом чужие, начиная с соседа
+static inline void *work_pool_find(struct work_worker *w) {
+    struct work_pool *pool = w->pool;
+    void *item;
+    int i;
+
+    if ( (item = work_deque_take(&w->deque)) != NULL )
+        return item;
+    for ( i = 1; i < pool->nworkers; i++ ) {
+        if ( (item = work_deque_take(&pool->workers[(w->id + i) % pool->nworkers].deque)) != NULL ) {
+            w->stolen++;
+            return item;
+        }
+    }
+    return NULL;
+}
+
+static inline void work_pool_run(struct work_worker *w, void *item) {
+    struct work_pool *pool = w->pool;
+    struct work_msg *m = (struct work_msg *)item;
+
+    if ( pool->flags & WORK_POOL_ORDERED ) {
+        __atomic_fetch_add(&w->done, work_strand_run(pool, (struct work_strand *)item), __ATOMIC_RELAXED);
+        return;
+    }
+    pool->fn(m->data, m->len, pool->arg);
+    free(m);
+    __atomic_fetch_add(&w->done, 1, __ATOMIC_RELAXED);
+}
+
+static void *work_pool_thread(void *p) {
+    struct work_worker *w = (struct work_worker *)p;
+    struct work_pool *pool = w->pool;
+    int spin = SHM_EVENT_SPIN, stopping;
+    uint32_t seq;
+    void *item;
+
+    for ( ;; ) {
+        //--- stop читаем до поиска: все, что отдано до остановки, поиск обязательно увидит
+        stopping = __atomic_load_n(&pool->stop, __ATOMIC_ACQUIRE);
+        if ( (item = work_pool_find(w)) != NULL ) {
+            work_pool_run(w, item);
+            spin = SHM_EVENT_SPIN;
+            continue;
+        }
+        if ( stopping )
+            break;
+        if ( spin-- > 0 ) {
+            cpu_relax();
+            continue;
+        }
+        seq = shm_event_prepare_wait(&pool->work);
+        if ( (item = work_pool_find(w)) != NULL || __atomic_load_n(&pool->stop, __ATOMIC_ACQUIRE) ) {
+            shm_event_cancel_wait(&pool->work);
+            if ( item )
+                work_pool_run(w, item);
+            continue;
+        }
+        shm_event_wait(&pool->work, seq);
+        spin = SHM_EVENT_SPIN;
+    }
+    return NULL;
+}
+
+static inline int work_pool_start(struct work_pool *pool, int nworkers, int flags, work_fn fn, void *arg) {
+    int i;
+
+    memset(pool, 0, sizeof(*pool));
+    if ( nworkers < 1 || nworkers > WORK_POOL_MAX )
+        return -1;
+    pool->flags = flags;
+    pool->fn = fn;
+    pool->arg = arg;
+    shm_event_init(&pool->work);
+    if ( posix_memalign((void **)&pool->workers, CACHE_LINE_SIZE, nworkers * sizeof(struct work_worker)) ||
+         posix_memalign((void **)&pool->strands, CACHE_LINE_SIZE, WORK_POOL_STRANDS * sizeof(struct work_strand)) ) {
+        perror("posix_memalign");
+        return -1;
+    }
+    memset(pool->workers, 0, nworkers * sizeof(struct work_worker));
+    pool->nworkers = nworkers;
+    memset(pool->strands, 0, WORK_POOL_STRANDS * sizeof(struct work_strand));
+    for ( i = 0; i < nworkers; i++ ) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].id = i;
+        if ( pthread_create(&pool->workers[i].tid, NULL, work_pool_thread, &pool->workers[i]) ) {
+            perror("pthread_create");
+            pool->nworkers = i;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+//--- Поток чтения: кладет работу в дек следующего рабочего; если все деки полны -
+//--- отдает процессор рабочим и пробует снова
+static inline void work_pool_push(struct work_pool *pool, void *item) {
+    int i;
+
+    for ( ;; ) {
+        for ( i = 0; i < pool->nworkers; i++ ) {
+            pool->next = (pool->next + 1) % pool->nworkers;
+            if ( work_deque_push(&pool->workers[pool->next].deque, item) == 0 ) {
+                shm_event_notify(&pool->work);
+                return;
+            }
+        }
+        pool->full++;
+        sched_yield();
+    }
+}
+
+//--- Поток чтения: копирует сообщение и отдает его пулу. key важен только в режиме с порядком.
+static inline int work_pool_submit(struct work_pool *pool, const char *data, uint32_t len, uint64_t key) {
+    struct work_strand *s;
+    struct work_msg *m;
+    uint32_t idle = 0;
+
+    if ( (m = (struct work_msg *)malloc(sizeof(*m) + len)) == NULL )
+        return -1;
+    m->len = len;
+    memcpy(m->data, data, len);
+    if ( !(pool->flags & WORK_POOL_ORDERED) ) {
+        work_pool_push(pool, m);
+        return 0;
+    }
+
+    s = &pool->strands[key % WORK_POOL_STRANDS];
+    while ( s->head - __atomic_load_n(&s->tail, __ATOMIC_ACQUIRE) >= WORK_POOL_STRAND_Q ) {
+        pool->full++;
+        sched_yield();
+    }
+    s->msgs[s->head & (WORK_POOL_STRAND_Q - 1)] = m;
+    __atomic_store_n(&s->head, s->head + 1, __ATOMIC_RELEASE);
+    //--- парный барьер к work_strand_run: либо владелец нити увидит новое сообщение,
+    //--- либо мы увидим, что нить свободна, и поставим ее в дек
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if ( !__atomic_load_n(&s->scheduled, __ATOMIC_RELAXED) &&
+         __atomic_compare_exchange_n(&s->scheduled, &idle, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED) )
+        work_pool_push(pool, s);
+    return 0;
+}
+
+//--- Дожидается обработки всего, что уже отдано, и останавливает рабочих
+static inline void work_pool_stop(struct work_pool *pool) {
+    int i;
+
+    __atomic_store_n(&pool->stop, 1, __ATOMIC_RELEASE);
+    shm_event_notify(&pool->work);
+    for ( i = 0; i < pool->nworkers; i++ )
+        pthread_join(pool->workers[i].tid, NULL);
+}
+
+static inline void work_pool_free(struct work_pool *pool) {
+    free(pool->workers);
+    free(pool->strands);
+}
+
+#endif